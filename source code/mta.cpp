@@ -0,0 +1,1874 @@
+// mta.cpp
+// Render core of the mta player, see mta.h
+// Build: make libmta.a, or add -DMTA_LIBAV for the in-process decoder
+
+#include "mta.h"
+#include <bits/stdc++.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+#include <termios.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef MTA_LIBAV
+#include <sys/eventfd.h>
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+#endif
+
+using namespace std;
+
+namespace mta {
+
+int clampi(int v, int a, int b) {
+    return v < a ? a : (v > b ? b : v);
+}
+
+int chroma_width(int w) { return (w + 1) / 2; }
+int cell_rows(int h) { return (h + 1) / 2; }
+
+size_t chroma_bytes(int w, int h) {
+    return (size_t)chroma_width(w) * cell_rows(h);
+}
+
+size_t yuv_frame_bytes(int w, int h) {
+    return (size_t)w * h + 2 * chroma_bytes(w, h);
+}
+
+size_t compact_frame_bytes(int w, int h) {
+    return (size_t)w * cell_rows(h) + 2 * chroma_bytes(w, h);
+}
+
+YuvView full_view(const unsigned char* frame, int w, int h) {
+    YuvView view;
+    view.y = frame;
+    view.y_stride = (size_t)w * 2;
+    view.u = frame + (size_t)w * h;
+    view.v = view.u + chroma_bytes(w, h);
+    view.c_stride = chroma_width(w);
+    return view;
+}
+
+YuvView compact_view(const unsigned char* frame, int w, int h) {
+    YuvView view;
+    view.y = frame;
+    view.y_stride = w;
+    view.u = frame + (size_t)w * cell_rows(h);
+    view.v = view.u + chroma_bytes(w, h);
+    view.c_stride = chroma_width(w);
+    return view;
+}
+
+void pack_rows(unsigned char* dst, const unsigned char* src, int w, int h) {
+    YuvView view = full_view(src, w, h);
+    for (int r = 0; r < cell_rows(h); r++) {
+        memcpy(dst, view.y + r * view.y_stride, w);
+        dst += w;
+    }
+    // U and V are back to back in both layouts
+    memcpy(dst, view.u, 2 * chroma_bytes(w, h));
+}
+
+// BT.601 limited range YUV to RGB for one sampled row, in 6-bit fixed
+// point: R = (75(Y-16) + 102(V-128)) >> 6 and so on. SSE2 converts eight
+// cells per step; the tail uses the same arithmetic one cell at a time.
+void yuv_row_to_rgb(const unsigned char* yp, const unsigned char* up, const unsigned char* vp, int w,
+                    unsigned char* r, unsigned char* g, unsigned char* b) {
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i y_off = _mm_set1_epi16(16), c_off = _mm_set1_epi16(128), round = _mm_set1_epi16(32);
+    const __m128i k_y = _mm_set1_epi16(75), k_rv = _mm_set1_epi16(102), k_gu = _mm_set1_epi16(25);
+    const __m128i k_gv = _mm_set1_epi16(52), k_bu = _mm_set1_epi16(129);
+    for (; x + 8 <= w; x += 8) {
+        __m128i yv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(yp + x)), zero);
+        int32_t u4, v4;
+        memcpy(&u4, up + x / 2, 4);
+        memcpy(&v4, vp + x / 2, 4);
+        // Each chroma sample covers two cells
+        __m128i uv = _mm_cvtsi32_si128(u4), vv = _mm_cvtsi32_si128(v4);
+        uv = _mm_unpacklo_epi8(_mm_unpacklo_epi8(uv, uv), zero);
+        vv = _mm_unpacklo_epi8(_mm_unpacklo_epi8(vv, vv), zero);
+
+        __m128i c = _mm_mullo_epi16(_mm_sub_epi16(yv, y_off), k_y);
+        __m128i d = _mm_sub_epi16(uv, c_off);
+        __m128i e = _mm_sub_epi16(vv, c_off);
+        // Saturating adds: anything past int16 is far outside 0..255 anyway
+        __m128i rv = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(e, k_rv)), round), 6);
+        __m128i gv = _mm_srai_epi16(_mm_adds_epi16(_mm_subs_epi16(_mm_subs_epi16(c, _mm_mullo_epi16(d, k_gu)),
+                                                                  _mm_mullo_epi16(e, k_gv)), round), 6);
+        __m128i bv = _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, k_bu)), round), 6);
+        _mm_storel_epi64((__m128i*)(r + x), _mm_packus_epi16(rv, rv));
+        _mm_storel_epi64((__m128i*)(g + x), _mm_packus_epi16(gv, gv));
+        _mm_storel_epi64((__m128i*)(b + x), _mm_packus_epi16(bv, bv));
+    }
+#endif
+    for (; x < w; x++) {
+        int c = 75 * (yp[x] - 16), d = up[x / 2] - 128, e = vp[x / 2] - 128;
+        r[x] = (unsigned char)clampi((c + 102 * e + 32) >> 6, 0, 255);
+        g[x] = (unsigned char)clampi((c - 25 * d - 52 * e + 32) >> 6, 0, 255);
+        b[x] = (unsigned char)clampi((c + 129 * d + 32) >> 6, 0, 255);
+    }
+}
+
+static uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+// XXH3-style accumulation: SSE2 takes 16 bytes per step through a 32x32->64
+// multiply against a key that moves with the position, so blocks that trade
+// places still change the hash. The tail goes through FNV-1a.
+static uint64_t hash_bytes(const unsigned char* p, size_t n, uint64_t seed) {
+    size_t i = 0;
+    uint64_t h = seed ^ 0xcbf29ce484222325ULL;
+#ifdef __SSE2__
+    if (n >= 16) {
+        __m128i acc = _mm_set_epi64x((long long)seed, (long long)~seed);
+        __m128i key = _mm_set_epi32(0x7e3779b9, (int)0x85ebca6b, (int)0xc2b2ae35, 0x27d4eb2f);
+        const __m128i key_step = _mm_set1_epi32((int)0x9e3779b1);
+        for (; i + 16 <= n; i += 16) {
+            __m128i data = _mm_loadu_si128((const __m128i*)(p + i));
+            __m128i dk = _mm_xor_si128(data, key);
+            __m128i product = _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)));
+            acc = _mm_add_epi64(acc, _mm_add_epi64(product, _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2))));
+            key = _mm_add_epi32(key, key_step);
+        }
+        uint64_t lanes[2];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        h = mix64(lanes[0] ^ mix64(lanes[1]));
+    }
+#endif
+    for (; i < n; i++) h = (h ^ p[i]) * 0x100000001b3ULL;
+    return mix64(h ^ n);
+}
+
+uint64_t frame_hash(const YuvView& frame, int w, int h) {
+    uint64_t hash = 0;
+    int cw = chroma_width(w);
+    for (int r = 0; r < cell_rows(h); r++) {
+        hash = hash_bytes(frame.y + r * frame.y_stride, w, hash);
+        hash = hash_bytes(frame.u + r * frame.c_stride, cw, hash);
+        hash = hash_bytes(frame.v + r * frame.c_stride, cw, hash);
+    }
+    return hash;
+}
+
+// Start a program with its stdout on a pipe. Unlike popen() this gives us
+// a raw fd for epoll and lets us kill the child instead of waiting for it.
+// With feed set the pipe goes the other way: we write, the child's stdin
+// reads, and our end stays blocking. There is no shell in between: file
+// names from directories and playlists are passed as they are.
+Child spawn_child(const vector<string>& argv, bool feed, ChildStderr err) {
+    Child child;
+    if (argv.empty()) return child;
+    // Built before fork: the child of a threaded process must not allocate
+    vector<char*> args;
+    for (const string& arg : argv) args.push_back(const_cast<char*>(arg.c_str()));
+    args.push_back(nullptr);
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) return child;
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        return child;
+    }
+    if (pid == 0) {
+        // The player blocks its signals for signalfd; don't pass that on
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, nullptr);
+        if (feed) {
+            dup2(fds[0], STDIN_FILENO);
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+        } else {
+            dup2(fds[1], STDOUT_FILENO);
+            if (err == STDERR_PIPE) dup2(fds[1], STDERR_FILENO);
+            // Keep ffmpeg away from the terminal so it doesn't eat our keys
+            int devnull = open("/dev/null", O_RDONLY);
+            if (devnull >= 0) dup2(devnull, STDIN_FILENO);
+        }
+        if (err == STDERR_NULL) {
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+        }
+        execvp(args[0], args.data());
+        _exit(127);
+    }
+
+    child.pid = pid;
+    if (feed) {
+        close(fds[0]);
+        child.fd = fds[1];
+        return child;
+    }
+    close(fds[1]);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    child.fd = fds[0];
+    return child;
+}
+
+void stop_child(Child& child) {
+    if (child.fd >= 0) close(child.fd);
+    if (child.pid > 0) {
+        kill(child.pid, SIGTERM);
+        waitpid(child.pid, nullptr, 0);
+    }
+    child = Child();
+}
+
+// Read a child's output to EOF (the fd is non-blocking)
+string read_child_output(Child& child) {
+    string text;
+    char buf[4096];
+    while (child.fd >= 0) {
+        ssize_t n = read(child.fd, buf, sizeof(buf));
+        if (n > 0) {
+            text.append(buf, n);
+        } else if (n == 0) {
+            break;
+        } else if (errno == EAGAIN) {
+            fd_set rfds;
+            FD_ZERO(&rfds);
+            FD_SET(child.fd, &rfds);
+            select(child.fd + 1, &rfds, nullptr, nullptr, nullptr);
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+    return text;
+}
+
+static const int CROP_FRAMES = 8;  // frames examined per position
+static const double CROP_MIN_CHANGE = 0.02;  // smaller changes (share of width or height) are ignored
+
+void crop_cancel(CropCancel& cancel) {
+    lock_guard<mutex> lk(cancel.m);
+    cancel.cancelled = true;
+    if (cancel.pid > 0) kill(cancel.pid, SIGTERM);
+}
+
+CropArea crop_union(CropArea a, CropArea b) {
+    if (a.w == 0 || b.w == 0) return CropArea();
+    int x1 = min(a.x, b.x), y1 = min(a.y, b.y);
+    int x2 = max(a.x + a.w, b.x + b.w), y2 = max(a.y + a.h, b.y + b.h);
+    return {x1, y1, x2 - x1, y2 - y1};
+}
+
+CropArea detect_crop(const string& file, const vector<double>& positions, CropCancel* cancel) {
+    int x1 = INT_MAX, y1 = INT_MAX, x2 = -1, y2 = -1;
+    for (double t : positions) {
+        stringstream seek;
+        seek << t;
+        vector<string> cmd = {"ffmpeg", "-hide_banner", "-nostdin"};
+        if (t > 0) cmd.insert(cmd.end(), {"-ss", seek.str()});
+        cmd.insert(cmd.end(), {"-i", file, "-an", "-frames:v", to_string(CROP_FRAMES),
+                               "-vf", "cropdetect=limit=24:round=2:reset=0", "-f", "null", "-"});
+        Child child;
+        {
+            lock_guard<mutex> lk(cancel->m);
+            if (cancel->cancelled) break;
+            child = spawn_child(cmd, false, STDERR_PIPE);  // cropdetect reports on stderr
+            cancel->pid = child.pid;
+        }
+        string out = read_child_output(child);
+        {
+            lock_guard<mutex> lk(cancel->m);
+            cancel->pid = -1;
+        }
+        stop_child(child);
+        // reset=0: the last line covers every frame examined
+        size_t pos = out.rfind("crop=");
+        int w, h, x, y;
+        if (pos == string::npos || sscanf(out.c_str() + pos, "crop=%d:%d:%d:%d", &w, &h, &x, &y) != 4) continue;
+        if (w <= 0 || h <= 0) continue;  // nothing but black
+        x1 = min(x1, x);
+        y1 = min(y1, y);
+        x2 = max(x2, x + w);
+        y2 = max(y2, y + h);
+    }
+    CropArea area;
+    if (x2 > x1 && y2 > y1) area = {x1, y1, x2 - x1, y2 - y1};
+    return area;
+}
+
+bool crop_differs(CropArea a, CropArea b, int video_w, int video_h) {
+    if (a.w == 0) a = {0, 0, video_w, video_h};
+    if (b.w == 0) b = {0, 0, video_w, video_h};
+    double dx = video_w * CROP_MIN_CHANGE, dy = video_h * CROP_MIN_CHANGE;
+    return abs(a.x - b.x) > dx || abs(a.x + a.w - b.x - b.w) > dx ||
+           abs(a.y - b.y) > dy || abs(a.y + a.h - b.y - b.h) > dy;
+}
+
+CropArea zoom_area(CropArea area, int video_w, int video_h, double zoom, double& cx, double& cy) {
+    if (zoom <= 1.0) {
+        cx = cy = 0.5;
+        return area;
+    }
+    if (area.w == 0) area = {0, 0, video_w, video_h};
+    double half = 0.5 / zoom;
+    cx = clamp(cx, half, 1.0 - half);
+    cy = clamp(cy, half, 1.0 - half);
+    CropArea view;
+    view.w = max(2, (int)(area.w / zoom) & ~1);
+    view.h = max(2, (int)(area.h / zoom) & ~1);
+    view.x = clamp(((int)(area.x + cx * area.w - view.w / 2.0)) & ~1, area.x, area.x + area.w - view.w);
+    view.y = clamp(((int)(area.y + cy * area.h - view.h / 2.0)) & ~1, area.y, area.y + area.h - view.h);
+    return view;
+}
+
+// Build the decoder command, starting at a specific position (in seconds)
+vector<string> decoder_args(const string& infile, const vector<string>& input_args,
+                            const vector<string>& output_args, double position) {
+    vector<string> args = {"ffmpeg", "-loglevel", "quiet", "-nostdin"};
+    args.insert(args.end(), input_args.begin(), input_args.end());
+    // Input seeking (-ss before -i) is fast and frame accurate for decoding
+    if (position > 0) {
+        stringstream pos;
+        pos << position;
+        args.insert(args.end(), {"-ss", pos.str()});
+    }
+    args.insert(args.end(), {"-i", infile});
+    args.insert(args.end(), output_args.begin(), output_args.end());
+    return args;
+}
+
+// Seek to specific position in video (in seconds) by restarting the decoder
+static bool seek_video(Child& decoder, const string& infile, const vector<string>& input_args,
+                       const vector<string>& output_args, double position) {
+    stop_child(decoder);
+    decoder = spawn_child(decoder_args(infile, input_args, output_args, position));
+    return decoder.fd >= 0;
+}
+
+
+// The decoder writes NUT instead of bare rawvideo so every frame arrives with
+// its real timestamp. Only the parts of the format a single rawvideo stream
+// uses are handled: main and stream headers (frame code table, time bases),
+// syncpoints (timestamp resets) and frame headers. Other packets are skipped.
+static const uint64_t NUT_MAIN_STARTCODE      = 0x7A561F5F04ADULL + ((uint64_t)(('N' << 8) + 'M') << 48);
+static const uint64_t NUT_STREAM_STARTCODE    = 0x11405BF2F9DBULL + ((uint64_t)(('N' << 8) + 'S') << 48);
+static const uint64_t NUT_SYNCPOINT_STARTCODE = 0xE4ADEECA4569ULL + ((uint64_t)(('N' << 8) + 'K') << 48);
+
+enum {
+    NUT_FLAG_CODED_PTS = 8, NUT_FLAG_STREAM_ID = 16, NUT_FLAG_SIZE_MSB = 32, NUT_FLAG_CHECKSUM = 64,
+    NUT_FLAG_RESERVED = 128, NUT_FLAG_SM_DATA = 256, NUT_FLAG_HEADER_IDX = 1024,
+    NUT_FLAG_MATCH_TIME = 2048, NUT_FLAG_CODED = 4096, NUT_FLAG_INVALID = 8192
+};
+
+struct NutFrameCode {
+    uint64_t flags = NUT_FLAG_INVALID;
+    uint64_t stream_id = 0, size_mul = 1, size_lsb = 0, reserved = 0, header_idx = 0;
+    int64_t pts_delta = 0;
+};
+
+struct NutStream {
+    int64_t tb_num = 1, tb_den = 1;
+    int msb_pts_shift = 0;
+    int64_t last_pts = 0;
+    bool video = false;
+    int width = 0, height = 0;
+};
+
+struct NutReader {
+    vector<unsigned char> buf;  // header bytes read but not parsed yet
+    size_t pos = 0;
+    bool got_id = false;
+    bool got_main = false;
+    NutFrameCode codes[256];
+    vector<pair<int64_t, int64_t>> time_bases;
+    vector<string> elision{""};  // header_idx -> bytes stripped from the frame
+    vector<NutStream> streams;
+
+    // Frame currently being read
+    bool in_frame = false;
+    bool frame_wanted = false;  // video frame of the expected size
+    size_t frame_stream = 0;
+    size_t frame_size = 0;
+    size_t frame_left = 0;  // payload bytes still in the pipe
+    size_t frame_fill = 0;
+    size_t frame_header = 0;
+    int64_t frame_pts = 0;
+};
+
+// Bounds-checked reader over buffered bytes; ok turns false when they run out
+struct NutCursor {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok = true;
+
+    uint64_t v() {
+        uint64_t val = 0;
+        for (;;) {
+            if (p >= end) { ok = false; return 0; }
+            unsigned char c = *p++;
+            val = (val << 7) | (c & 0x7f);
+            if (!(c & 0x80)) return val;
+        }
+    }
+    int64_t s() {
+        uint64_t t = v() + 1;
+        return (t & 1) ? -(int64_t)(t >> 1) : (int64_t)(t >> 1);
+    }
+    uint64_t u64() {
+        uint64_t val = 0;
+        for (int i = 0; i < 8; i++) {
+            if (p >= end) { ok = false; return 0; }
+            val = (val << 8) | *p++;
+        }
+        return val;
+    }
+    void skip(uint64_t n) {
+        if ((uint64_t)(end - p) < n) { ok = false; p = end; }
+        else p += n;
+    }
+};
+
+static bool nut_main_header(NutReader& nut, NutCursor& c) {
+    if (c.v() > 3) c.v();  // minor version
+    uint64_t stream_count = c.v();
+    c.v();  // max_distance
+    uint64_t tb_count = c.v();
+    if (!c.ok || stream_count == 0 || stream_count > 256 || tb_count == 0 || tb_count > 256) return false;
+    nut.time_bases.clear();
+    for (uint64_t i = 0; i < tb_count; i++) {
+        int64_t num = c.v(), den = c.v();
+        if (num <= 0 || den <= 0) return false;
+        nut.time_bases.push_back({num, den});
+    }
+
+    // Run-length coded frame code table
+    int64_t tmp_pts = 0;
+    uint64_t tmp_mul = 1, tmp_stream = 0, tmp_head_idx = 0;
+    for (int i = 0; i < 256 && c.ok;) {
+        uint64_t tmp_flags = c.v();
+        uint64_t fields = c.v();
+        if (fields > 0) tmp_pts = c.s();
+        if (fields > 1) tmp_mul = c.v();
+        if (fields > 2) tmp_stream = c.v();
+        uint64_t tmp_size = fields > 3 ? c.v() : 0;
+        uint64_t tmp_res = fields > 4 ? c.v() : 0;
+        uint64_t count = fields > 5 ? c.v() : tmp_mul - tmp_size;
+        if (fields > 6) c.s();  // match time delta
+        if (fields > 7) tmp_head_idx = c.v();
+        for (uint64_t f = 8; f < fields && c.ok; f++) c.v();
+        if (count == 0 || count > 256) return false;
+
+        for (uint64_t j = 0; j < count && i < 256; j++, i++) {
+            NutFrameCode& fc = nut.codes[i];
+            if (i == 'N') {
+                fc = NutFrameCode();
+                j--;
+                continue;
+            }
+            fc.flags = tmp_flags;
+            fc.stream_id = tmp_stream;
+            fc.size_mul = tmp_mul;
+            fc.size_lsb = tmp_size + j;
+            fc.reserved = tmp_res;
+            fc.header_idx = tmp_head_idx;
+            fc.pts_delta = tmp_pts;
+        }
+    }
+
+    // Elision headers: prefixes the muxer strips from matching frames
+    nut.elision.assign(1, "");
+    if (c.ok && c.p < c.end) {
+        uint64_t header_count = c.v() + 1;
+        for (uint64_t i = 1; i < header_count && c.ok && header_count <= 128; i++) {
+            uint64_t len = c.v();
+            if (len > 256 || (uint64_t)(c.end - c.p) < len) return false;
+            nut.elision.push_back(string((const char*)c.p, len));
+            c.p += len;
+        }
+    }
+    nut.streams.assign(stream_count, NutStream());
+    nut.got_main = true;
+    return c.ok;
+}
+
+static bool nut_stream_header(NutReader& nut, NutCursor& c) {
+    uint64_t id = c.v();
+    uint64_t stream_class = c.v();
+    c.skip(c.v());  // fourcc
+    uint64_t tb_id = c.v();
+    if (!c.ok || id >= nut.streams.size() || tb_id >= nut.time_bases.size()) return false;
+    NutStream& st = nut.streams[id];
+    st.tb_num = nut.time_bases[tb_id].first;
+    st.tb_den = nut.time_bases[tb_id].second;
+    st.msb_pts_shift = (int)min<uint64_t>(c.v(), 62);
+    c.v();  // max_pts_distance
+    c.v();  // decode_delay
+    c.v();  // stream flags
+    c.skip(c.v());  // codec specific data
+    if (stream_class == 0) {
+        st.video = true;
+        st.width = (int)c.v();
+        st.height = (int)c.v();
+    }
+    return c.ok;
+}
+
+static bool nut_syncpoint(NutReader& nut, NutCursor& c) {
+    uint64_t coded = c.v();
+    c.v();  // back pointer
+    if (!c.ok || nut.time_bases.empty()) return false;
+    const auto& tb = nut.time_bases[coded % nut.time_bases.size()];
+    int64_t ts = coded / nut.time_bases.size();
+    // Every stream restarts from the syncpoint time in its own time base
+    for (NutStream& st : nut.streams) {
+        __int128 num = (__int128)ts * tb.first * st.tb_den;
+        __int128 den = (__int128)tb.second * st.tb_num;
+        st.last_pts = (int64_t)(num / den);
+    }
+    return true;
+}
+
+enum NutStatus { NUT_NEED_MORE, NUT_FRAME, NUT_ERROR };
+
+// Parse buffered packets up to the next frame header
+static NutStatus nut_parse(NutReader& nut) {
+    static const char id_string[] = "nut/multimedia container";  // sent with its NUL
+    for (;;) {
+        NutCursor c{nut.buf.data() + nut.pos, nut.buf.data() + nut.buf.size()};
+        if (!nut.got_id) {
+            if ((size_t)(c.end - c.p) < sizeof(id_string)) return NUT_NEED_MORE;
+            if (memcmp(c.p, id_string, sizeof(id_string)) != 0) return NUT_ERROR;
+            nut.pos += sizeof(id_string);
+            nut.got_id = true;
+            continue;
+        }
+        if (c.p >= c.end) return NUT_NEED_MORE;
+
+        if (*c.p == 'N') {
+            // 'N' is never a valid frame code, so this is a startcode
+            uint64_t startcode = c.u64();
+            uint64_t forward_ptr = c.v();
+            if (forward_ptr > 4096) c.skip(4);  // header checksum
+            if (!c.ok || (uint64_t)(c.end - c.p) < forward_ptr) return NUT_NEED_MORE;
+            if (forward_ptr < 4) return NUT_ERROR;
+            NutCursor body{c.p, c.p + forward_ptr - 4};  // without the trailing checksum
+            bool ok = true;
+            if (startcode == NUT_MAIN_STARTCODE) ok = nut_main_header(nut, body);
+            else if (startcode == NUT_STREAM_STARTCODE) ok = nut.got_main && nut_stream_header(nut, body);
+            else if (startcode == NUT_SYNCPOINT_STARTCODE) ok = nut_syncpoint(nut, body);
+            if (!ok) return NUT_ERROR;
+            nut.pos = (c.p + forward_ptr) - nut.buf.data();
+            continue;
+        }
+
+        if (!nut.got_main) return NUT_ERROR;
+        const NutFrameCode& fc = nut.codes[*c.p++];
+        uint64_t flags = fc.flags;
+        if (flags & NUT_FLAG_INVALID) return NUT_ERROR;
+        if (flags & NUT_FLAG_CODED) flags ^= c.v();
+        uint64_t stream_id = (flags & NUT_FLAG_STREAM_ID) ? c.v() : fc.stream_id;
+        if (!c.ok) return NUT_NEED_MORE;
+        if (stream_id >= nut.streams.size()) return NUT_ERROR;
+        NutStream& st = nut.streams[stream_id];
+
+        int64_t pts;
+        if (flags & NUT_FLAG_CODED_PTS) {
+            uint64_t coded = c.v();
+            uint64_t range = 1ULL << st.msb_pts_shift;
+            if (coded < range) {
+                // Only the low bits are sent: pick the value closest to last_pts
+                int64_t mask = (int64_t)range - 1;
+                int64_t delta = st.last_pts - mask / 2;
+                pts = (((int64_t)coded - delta) & mask) + delta;
+            } else {
+                pts = (int64_t)(coded - range);
+            }
+        } else {
+            pts = st.last_pts + fc.pts_delta;
+        }
+        uint64_t size = fc.size_lsb;
+        if (flags & NUT_FLAG_SIZE_MSB) size += fc.size_mul * c.v();
+        if (flags & NUT_FLAG_MATCH_TIME) c.s();
+        uint64_t header_idx = (flags & NUT_FLAG_HEADER_IDX) ? c.v() : fc.header_idx;
+        uint64_t reserved = (flags & NUT_FLAG_RESERVED) ? c.v() : fc.reserved;
+        for (uint64_t i = 0; i < reserved && c.ok; i++) c.v();
+        if (flags & NUT_FLAG_CHECKSUM) c.skip(4);
+        if (!c.ok) return NUT_NEED_MORE;
+        if (flags & NUT_FLAG_SM_DATA) return NUT_ERROR;  // side data is never enabled for our output
+        if (size > 4096) header_idx = 0;
+        if (header_idx >= nut.elision.size() || size < nut.elision[header_idx].size()) return NUT_ERROR;
+
+        st.last_pts = pts;
+        nut.pos = c.p - nut.buf.data();
+        nut.frame_stream = stream_id;
+        nut.frame_size = size;
+        nut.frame_header = header_idx;
+        nut.frame_left = size - nut.elision[header_idx].size();
+        nut.frame_pts = pts;
+        return NUT_FRAME;
+    }
+}
+
+// Read from the non-blocking decoder pipe until a whole video frame of
+// dst_size bytes is in dst. Frame payloads are read straight into dst; only
+// the few bytes that arrive in the same read as a header are copied.
+// Returns 1 with pts (seconds) for a frame, 0 when the pipe is drained for
+// now, -1 at end of stream or on data we can't parse.
+static int nut_read_frame(NutReader& nut, int fd, unsigned char* dst, size_t dst_size, double& pts) {
+    unsigned char scratch[4096];
+    for (;;) {
+        if (nut.in_frame) {
+            size_t avail = nut.buf.size() - nut.pos;
+            if (avail > 0 && nut.frame_left > 0) {
+                size_t k = min(avail, nut.frame_left);
+                if (nut.frame_wanted) memcpy(dst + nut.frame_fill, nut.buf.data() + nut.pos, k);
+                nut.pos += k;
+                nut.frame_fill += k;
+                nut.frame_left -= k;
+            }
+            while (nut.frame_left > 0) {
+                // Frames we don't want (other streams, wrong size) are discarded
+                unsigned char* target = nut.frame_wanted ? dst + nut.frame_fill : scratch;
+                size_t want = nut.frame_wanted ? nut.frame_left : min(nut.frame_left, sizeof(scratch));
+                ssize_t n = read(fd, target, want);
+                if (n > 0) {
+                    nut.frame_fill += n;
+                    nut.frame_left -= n;
+                    continue;
+                }
+                if (n == 0) return -1;
+                if (errno == EINTR) continue;
+                return errno == EAGAIN ? 0 : -1;
+            }
+            nut.in_frame = false;
+            if (nut.frame_wanted) {
+                const NutStream& st = nut.streams[nut.frame_stream];
+                pts = (double)nut.frame_pts * st.tb_num / st.tb_den;
+                return 1;
+            }
+            continue;
+        }
+
+        NutStatus status = nut_parse(nut);
+        if (status == NUT_ERROR) return -1;
+        if (status == NUT_FRAME) {
+            nut.in_frame = true;
+            nut.frame_wanted = nut.streams[nut.frame_stream].video && nut.frame_size == dst_size;
+            nut.frame_fill = 0;
+            if (nut.frame_wanted) {
+                const string& prefix = nut.elision[nut.frame_header];
+                memcpy(dst, prefix.data(), prefix.size());
+                nut.frame_fill = prefix.size();
+            }
+            continue;
+        }
+
+        // Headers are read in small chunks so little frame data gets copied
+        nut.buf.erase(nut.buf.begin(), nut.buf.begin() + nut.pos);
+        nut.pos = 0;
+        size_t old = nut.buf.size();
+        nut.buf.resize(old + 64);
+        ssize_t n = read(fd, nut.buf.data() + old, 64);
+        nut.buf.resize(old + max<ssize_t>(n, 0));
+        if (n > 0) continue;
+        if (n == 0) return -1;
+        if (errno == EINTR) continue;
+        return errno == EAGAIN ? 0 : -1;
+    }
+}
+
+// ffmpeg input arguments. Timestamps are kept as they are in the file
+// (shifted to start at zero), so every frame carries its position in the
+// source no matter where decoding started. keyframes_only selects fast-forward.
+// Live feeds get minimal probing and input buffering, and keep the
+// timestamps the source sent, so wall-clock stamped feeds give true latency.
+static vector<string> build_input_args(const DecodeSettings& settings, bool keyframes_only) {
+    if (settings.live) {
+        return {"-fflags", "nobuffer", "-flags", "low_delay", "-probesize", "32", "-analyzeduration", "0", "-copyts"};
+    }
+    vector<string> args = {"-copyts", "-start_at_zero"};
+    if (keyframes_only) args.insert(args.end(), {"-skip_frame", "nokey"});
+    return args;
+}
+
+// ffmpeg output arguments for the output size (seek position is added per spawn).
+// Frames go out in NUT with their own timestamps and without frame rate
+// conversion.
+static vector<string> build_output_args(const DecodeSettings& settings) {
+    vector<string> args = {"-an", "-f", "nut", "-c:v", "rawvideo", "-pix_fmt", "yuv420p", "-fps_mode", "passthrough"};
+    string filter = settings.filter;
+    if (settings.crop_w > 0) {
+        string crop = "crop=" + to_string(settings.crop_w) + ":" + to_string(settings.crop_h) + ":" +
+                      to_string(settings.crop_x) + ":" + to_string(settings.crop_y);
+        filter = filter.empty() ? crop : crop + "," + filter;
+    }
+    if (!filter.empty()) args.insert(args.end(), {"-vf", filter});
+    // Live frames leave the muxer as soon as they are decoded
+    if (settings.live) args.insert(args.end(), {"-flush_packets", "1"});
+    args.insert(args.end(), {"-s", to_string(settings.width) + "x" + to_string(settings.height), "pipe:1"});
+    return args;
+}
+
+// ffmpeg in a child process writing NUT to a pipe; restarted on every seek
+struct PipeDecoder : Decoder {
+    Child child;
+    NutReader nut;
+
+    ~PipeDecoder() { stop(); }
+    const char* name() const override { return "ffmpeg pipe"; }
+    int fd() const override { return child.fd; }
+    bool start(const DecodeSettings& settings, double position, bool keyframes_only) override {
+        nut = NutReader();
+        return seek_video(child, settings.input, build_input_args(settings, keyframes_only),
+                          build_output_args(settings), position);
+    }
+    int read_frame(unsigned char* dst, size_t size, double& pts) override {
+        return nut_read_frame(nut, child.fd, dst, size, pts);
+    }
+    void stop() override { stop_child(child); }
+};
+
+#ifdef MTA_LIBAV
+// libavformat/libavcodec in-process. Seeks are av_seek_frame() calls on the
+// open file, and swscale converts straight from the decoder's planes into
+// the player's frame buffer. Frames are decoded on demand, so fd() is an
+// eventfd that is always readable.
+struct LibavDecoder : Decoder {
+    AVFormatContext* fmt = nullptr;
+    AVCodecContext* codec = nullptr;
+    SwsContext* sws = nullptr;
+    AVPacket* pkt = nullptr;
+    AVFrame* frame = nullptr;
+    int stream = -1;
+    int event_fd = -1;
+    string file;
+    int out_w = 0, out_h = 0;
+    int crop_x = 0, crop_y = 0, crop_w = 0, crop_h = 0;
+    double seek_target = 0.0;  // frames before this are decoded but not returned
+    bool draining = false;     // demuxer hit EOF, decoder is being flushed
+
+    ~LibavDecoder() {
+        stop();
+        close_input();
+    }
+    const char* name() const override { return "libav"; }
+    int fd() const override { return event_fd; }
+
+    void close_input() {
+        sws_freeContext(sws);
+        sws = nullptr;
+        av_frame_free(&frame);
+        av_packet_free(&pkt);
+        avcodec_free_context(&codec);
+        avformat_close_input(&fmt);
+        file.clear();
+    }
+
+    bool open_input(const string& infile) {
+        if (avformat_open_input(&fmt, infile.c_str(), nullptr, nullptr) < 0) return false;
+        if (avformat_find_stream_info(fmt, nullptr) < 0) return false;
+        const AVCodec* dec = nullptr;
+        stream = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, &dec, 0);
+        if (stream < 0 || !dec) return false;
+        // Nothing but the video stream is demuxed
+        for (unsigned i = 0; i < fmt->nb_streams; i++) {
+            if ((int)i != stream) fmt->streams[i]->discard = AVDISCARD_ALL;
+        }
+        codec = avcodec_alloc_context3(dec);
+        if (!codec || avcodec_parameters_to_context(codec, fmt->streams[stream]->codecpar) < 0) return false;
+        codec->thread_count = 0;  // one per core
+        if (avcodec_open2(codec, dec, nullptr) < 0) return false;
+        pkt = av_packet_alloc();
+        frame = av_frame_alloc();
+        if (!pkt || !frame) return false;
+        file = infile;
+        return true;
+    }
+
+    // Seconds from the start of the file, like -copyts -start_at_zero
+    double frame_time() const {
+        int64_t ts = frame->best_effort_timestamp;
+        if (ts == AV_NOPTS_VALUE) ts = frame->pts;
+        if (ts == AV_NOPTS_VALUE) return seek_target;
+        double t = ts * av_q2d(fmt->streams[stream]->time_base);
+        if (fmt->start_time != AV_NOPTS_VALUE) t -= fmt->start_time / (double)AV_TIME_BASE;
+        return t;
+    }
+
+    bool start(const DecodeSettings& settings, double position, bool keyframes_only) override {
+        bool fresh = file != settings.input;
+        if (fresh) {
+            close_input();
+            if (!open_input(settings.input)) {
+                close_input();
+                return false;
+            }
+        }
+        if (!fresh || position > 0) {
+            int64_t ts = (int64_t)(position * AV_TIME_BASE);
+            if (fmt->start_time != AV_NOPTS_VALUE) ts += fmt->start_time;
+            if (av_seek_frame(fmt, -1, ts, AVSEEK_FLAG_BACKWARD) < 0) return false;
+            avcodec_flush_buffers(codec);
+        }
+        codec->skip_frame = keyframes_only ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+        out_w = settings.width;
+        out_h = settings.height;
+        crop_x = settings.crop_x;
+        crop_y = settings.crop_y;
+        crop_w = settings.crop_w;
+        crop_h = settings.crop_h;
+        seek_target = position;
+        draining = false;
+        if (event_fd < 0) event_fd = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK);
+        return event_fd >= 0;
+    }
+
+    int read_frame(unsigned char* dst, size_t size, double& pts) override {
+        size_t luma = (size_t)out_w * out_h;
+        int cw = (out_w + 1) / 2;
+        size_t chroma = (size_t)cw * ((out_h + 1) / 2);
+        if (!codec || size != luma + 2 * chroma) return -1;
+        for (;;) {
+            int r = avcodec_receive_frame(codec, frame);
+            if (r == 0) {
+                double t = frame_time();
+                // Accurate seeking: decode from the keyframe, show from the target
+                if (t + 0.001 < seek_target) {
+                    av_frame_unref(frame);
+                    continue;
+                }
+                if (crop_w > 0 && crop_x + crop_w <= frame->width && crop_y + crop_h <= frame->height) {
+                    frame->crop_left = crop_x;
+                    frame->crop_top = crop_y;
+                    frame->crop_right = frame->width - crop_x - crop_w;
+                    frame->crop_bottom = frame->height - crop_y - crop_h;
+                    av_frame_apply_cropping(frame, AV_FRAME_CROP_UNALIGNED);
+                }
+                sws = sws_getCachedContext(sws, frame->width, frame->height, (AVPixelFormat)frame->format,
+                                           out_w, out_h, AV_PIX_FMT_YUV420P, SWS_BICUBIC, nullptr, nullptr, nullptr);
+                if (!sws) return -1;
+                uint8_t* planes[4] = {dst, dst + luma, dst + luma + chroma, nullptr};
+                int strides[4] = {out_w, cw, cw, 0};
+                sws_scale(sws, frame->data, frame->linesize, 0, frame->height, planes, strides);
+                av_frame_unref(frame);
+                pts = t;
+                return 1;
+            }
+            if (r != AVERROR(EAGAIN) || draining) return -1;
+
+            if (av_read_frame(fmt, pkt) < 0) {
+                avcodec_send_packet(codec, nullptr);
+                draining = true;
+                continue;
+            }
+            if (pkt->stream_index == stream) avcodec_send_packet(codec, pkt);
+            av_packet_unref(pkt);
+        }
+    }
+
+    // The file stays open so the next start() is only a seek
+    void stop() override {
+        if (event_fd >= 0) close(event_fd);
+        event_fd = -1;
+    }
+};
+#endif
+
+bool has_libav() {
+#ifdef MTA_LIBAV
+    return true;
+#else
+    return false;
+#endif
+}
+
+unique_ptr<Decoder> open_decoder(const string& backend, const DecodeSettings& settings,
+                                 double position, bool keyframes_only) {
+#ifdef MTA_LIBAV
+    if (backend != "pipe") {
+        auto dec = make_unique<LibavDecoder>();
+        if (dec->start(settings, position, keyframes_only)) return dec;
+        if (backend == "libav") return nullptr;
+    }
+#else
+    if (backend == "libav") return nullptr;  // asked for, but not built in
+#endif
+    auto dec = make_unique<PipeDecoder>();
+    if (!dec->start(settings, position, keyframes_only)) return nullptr;
+    return dec;
+}
+
+void loop_cache_reset(LoopCache& cache, size_t frame_bytes, size_t expected_frames) {
+    cache.frame_bytes = frame_bytes;
+    cache.frames = 0;
+    cache.overflow = expected_frames * frame_bytes > cache.budget;
+    if (cache.overflow) {
+        vector<unsigned char>().swap(cache.arena);
+        vector<double>().swap(cache.times);
+        return;
+    }
+    cache.arena.clear();
+    cache.times.clear();
+    // Reserve up front so capturing never reallocates mid-clip
+    cache.arena.reserve(expected_frames * frame_bytes);
+    cache.times.reserve(expected_frames);
+}
+
+bool loop_cache_add(LoopCache& cache, const unsigned char* frame, int w, int h, double time) {
+    if (cache.overflow) return false;
+    if ((cache.frames + 1) * cache.frame_bytes > cache.budget) {
+        cache.overflow = true;
+        cache.frames = 0;
+        vector<unsigned char>().swap(cache.arena);
+        vector<double>().swap(cache.times);
+        return false;
+    }
+    size_t end = cache.arena.size();
+    cache.arena.resize(end + cache.frame_bytes);
+    pack_rows(cache.arena.data() + end, frame, w, h);
+    cache.times.push_back(time);
+    cache.frames++;
+    return true;
+}
+
+void ring_reset(RewindRing& ring, size_t slot_bytes, size_t budget) {
+    ring.slot_bytes = slot_bytes;
+    ring.capacity = slot_bytes > 0 ? budget / slot_bytes : 0;
+    ring.head = 0;
+    ring.count = 0;
+    // Only reserved: slots are added as they are first written, so a
+    // relayout doesn't zero-fill the whole budget up front
+    ring.slots.clear();
+    ring.slots.reserve(ring.capacity * slot_bytes);
+    ring.times.resize(ring.capacity);
+}
+
+void ring_push(RewindRing& ring, const unsigned char* frame, int w, int h, double time) {
+    if (ring.capacity == 0) return;
+    size_t end = (ring.head + 1) * ring.slot_bytes;
+    if (ring.slots.size() < end) ring.slots.resize(end);
+    pack_rows(ring.slots.data() + ring.head * ring.slot_bytes, frame, w, h);
+    ring.times[ring.head] = time;
+    ring.head = (ring.head + 1) % ring.capacity;
+    if (ring.count < ring.capacity) ring.count++;
+}
+
+long ring_find(const RewindRing& ring, double t) {
+    if (ring.count == 0) return -1;
+    if (t < ring.times[ring.slot(0)] || t > ring.times[ring.slot(ring.count - 1)]) return -1;
+    size_t lo = 0, hi = ring.count - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi + 1) / 2;
+        if (ring.times[ring.slot(mid)] <= t) lo = mid;
+        else hi = mid - 1;
+    }
+    return (long)lo;
+}
+
+// Look up an executable in PATH without spawning a shell
+bool in_path(const string& prog) {
+    const char* path = getenv("PATH");
+    if (!path) return false;
+    stringstream dirs(path);
+    string dir;
+    while (getline(dirs, dir, ':')) {
+        if (dir.empty()) dir = ".";
+        if (access((dir + "/" + prog).c_str(), X_OK) == 0) return true;
+    }
+    return false;
+}
+
+// Plays through a program that reads raw PCM on stdin (pacat, aplay).
+// The pipe is kept at one page so little audio is queued outside the
+// device buffer, whose size we ask the program for.
+struct ProcessSink : AudioSink {
+    vector<string> cmd;
+    double device_latency;
+    Child child;
+
+    ProcessSink(const vector<string>& c, double dev) : cmd(c), device_latency(dev) {}
+    ~ProcessSink() { close(); }
+
+    bool open() override {
+        child = spawn_child(cmd, true);
+        if (child.fd < 0) return false;
+        fcntl(child.fd, F_SETPIPE_SZ, 4096);
+        return true;
+    }
+    bool write(const char* data, size_t bytes) override {
+        if (child.fd < 0 && !open()) return false;
+        while (bytes > 0) {
+            ssize_t n = ::write(child.fd, data, bytes);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            bytes -= n;
+        }
+        return true;
+    }
+    double latency() override {
+        int queued = 0;
+        if (child.fd >= 0) ioctl(child.fd, FIONREAD, &queued);
+        return queued / AUDIO_BYTE_RATE + device_latency;
+    }
+    void flush() override {
+        // A pipe can't be emptied from the writing end: stop the player,
+        // the next write starts a new one
+        stop_child(child);
+    }
+    void close() override { stop_child(child); }
+};
+
+// Discards audio, or writes it to a file, at real-time pace. Behaves like a
+// device with a small buffer so the audio clock works the same headless.
+struct PacedSink : AudioSink {
+    string path;  // empty = null sink
+    int fd = -1;
+    chrono::steady_clock::time_point start;
+    double written = 0.0;  // seconds since the last flush
+    const double buffer = 0.02;
+
+    explicit PacedSink(const string& p) : path(p) {}
+    ~PacedSink() { close(); }
+
+    bool open() override {
+        if (!path.empty()) {
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0) return false;
+        }
+        flush();
+        return true;
+    }
+    bool write(const char* data, size_t bytes) override {
+        if (fd >= 0) {
+            for (size_t off = 0; off < bytes;) {
+                ssize_t n = ::write(fd, data + off, bytes - off);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) return false;
+                off += n;
+            }
+        }
+        // Like a device, playback starts when the first samples arrive
+        if (written == 0.0) start = chrono::steady_clock::now();
+        written += bytes / AUDIO_BYTE_RATE;
+        double ahead = written - chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (ahead > buffer) this_thread::sleep_for(chrono::duration<double>(ahead - buffer));
+        return true;
+    }
+    double latency() override {
+        return max(0.0, written - chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    void flush() override {
+        start = chrono::steady_clock::now();
+        written = 0.0;
+    }
+    void close() override {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+};
+
+unique_ptr<AudioSink> make_audio_sink(const string& name) {
+    string rate = to_string(AUDIO_RATE), channels = to_string(AUDIO_CHANNELS);
+    bool any = name.empty();
+    if ((name == "pulse" || any) && in_path("pacat")) {
+        return make_unique<ProcessSink>(vector<string>{"pacat", "--raw", "--format=s16le", "--rate=" + rate,
+                                                       "--channels=" + channels, "--latency-msec=30",
+                                                       "--client-name=mta"}, 0.03);
+    }
+    if ((name == "alsa" || any) && in_path("aplay")) {
+        return make_unique<ProcessSink>(vector<string>{"aplay", "-q", "-t", "raw", "-f", "S16_LE", "-r", rate,
+                                                       "-c", channels, "--buffer-time=40000"}, 0.04);
+    }
+    if (name == "null" || any) return make_unique<PacedSink>("");
+    if (name.rfind("file:", 0) == 0) return make_unique<PacedSink>(name.substr(5));
+    return nullptr;
+}
+
+// Larger changes are chained
+string atempo_filter(float speed) {
+    string chain;
+    double rest = speed;
+    while (rest > 2.0) { chain += "atempo=2.0,"; rest /= 2.0; }
+    while (rest < 0.5) { chain += "atempo=0.5,"; rest /= 0.5; }
+    return chain + "atempo=" + to_string(rest);
+}
+
+static void audio_worker(AudioPlayer* ap) {
+    // A sink that dies must not take the player down with SIGPIPE
+    sigset_t pipe_sig;
+    sigemptyset(&pipe_sig);
+    sigaddset(&pipe_sig, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_sig, nullptr);
+
+    int fd = ap->decoder.fd;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    char buf[4096];
+    double written = 0.0;  // seconds of output so far
+    auto publish = [&](double played) {
+        lock_guard<mutex> g(ap->lock);
+        if (played <= 0) return;
+        ap->state = AUDIO_PLAYING;
+        ap->pos = ap->start_pos + played * ap->speed;
+        ap->at = chrono::steady_clock::now();
+    };
+
+    while (!ap->stop) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        if (!ap->sink->write(buf, n)) break;
+        written += n / AUDIO_BYTE_RATE;
+        publish(written - ap->sink->latency());
+    }
+    // Keep the clock going while the tail plays out
+    while (!ap->stop && ap->sink->latency() > 0.005) {
+        this_thread::sleep_for(chrono::milliseconds(5));
+        publish(written - ap->sink->latency());
+    }
+    lock_guard<mutex> g(ap->lock);
+    ap->state = AUDIO_ENDED;
+}
+
+void audio_stop(AudioPlayer& ap) {
+    if (ap.worker.joinable()) {
+        ap.stop = true;
+        // Unblocks the worker's read; a blocked sink write returns within its buffer time
+        if (ap.decoder.pid > 0) kill(ap.decoder.pid, SIGTERM);
+        ap.worker.join();
+        ap.sink->flush();
+    }
+    stop_child(ap.decoder);
+    lock_guard<mutex> g(ap.lock);
+    ap.state = AUDIO_OFF;
+}
+
+// Speed is applied with atempo
+bool audio_start(AudioPlayer& ap, const string& infile, double position, float speed) {
+    audio_stop(ap);
+    vector<string> args = {"-vn"};
+    if (speed != 1.0f) args.insert(args.end(), {"-af", atempo_filter(speed)});
+    args.insert(args.end(), {"-f", "s16le", "-ac", to_string(AUDIO_CHANNELS), "-ar", to_string(AUDIO_RATE), "pipe:1"});
+    ap.decoder = spawn_child(decoder_args(infile, {}, args, position));
+    if (ap.decoder.fd < 0) return false;
+    {
+        lock_guard<mutex> g(ap.lock);
+        ap.state = AUDIO_STARTING;
+        ap.start_pos = position;
+        ap.pos = position;
+        ap.speed = speed;
+    }
+    ap.stop = false;
+    ap.worker = thread(audio_worker, &ap);
+    return true;
+}
+
+AudioState audio_clock(AudioPlayer& ap, double& t) {
+    lock_guard<mutex> g(ap.lock);
+    if (ap.state == AUDIO_PLAYING) {
+        t = ap.pos + chrono::duration<double>(chrono::steady_clock::now() - ap.at).count() * ap.speed;
+    } else if (ap.state == AUDIO_ENDED) {
+        t = ap.pos;
+    }
+    return ap.state;
+}
+
+void MediaClock::set(double t) {
+    base_ = t;
+    wall_ = chrono::steady_clock::now();
+}
+
+double MediaClock::now() {
+    if (audio) {
+        double t = base_;
+        AudioState state = audio_clock(*audio, t);
+        if (state == AUDIO_PLAYING) return t;
+        if (state == AUDIO_STARTING) return base_;  // hold until the first samples are heard
+        // Audio ran out (or there is none): the wall clock goes on from here
+        audio = nullptr;
+        set(t);
+    }
+    return base_ + chrono::duration<double>(chrono::steady_clock::now() - wall_).count() * speed;
+}
+
+enum ColorMode { COLOR_NONE, COLOR_16, COLOR_256, COLOR_PALETTE, COLOR_TRUE };
+
+// Up to 4 output bytes, always copied as 4: the row buffer keeps slack
+// past the write position, so only n of them count
+struct Piece {
+    char s[4];
+    uint8_t n;
+};
+
+// Decimal text of 0..255, for escape code parameters
+struct DecimalTable {
+    Piece dec[256];
+    DecimalTable() {
+        for (int i = 0; i < 256; i++) {
+            dec[i].n = snprintf(dec[i].s, sizeof(dec[i].s), "%d", i);
+        }
+    }
+};
+
+using RowKernel = void (*)(string& out, const CellEncoder& enc, const unsigned char* yp,
+                           const unsigned char* up, const unsigned char* vp, int w, int row);
+
+// The 16 basic colors as xterm draws them by default, with their SGR
+// foreground codes (30-37, bright 90-97)
+static const unsigned char PALETTE16[16][3] = {
+    {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0}, {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0}, {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255},
+};
+
+// 4x4 Bayer matrix, for the ordered dither of -16
+static const int BAYER4[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+
+// Everything the cell encoder needs that only depends on the settings,
+// built once per session: the glyph for every luma value and the row
+// kernel instantiated for the color mode and ramp encoding
+struct CellEncoder {
+    DecimalTable decimals;
+    ColorMode color = COLOR_NONE;
+    bool utf8 = false;  // the ramp has multibyte glyphs (-Ru)
+    Piece glyph[256];  // by luma
+    RowKernel row = nullptr;
+    // 16-color mode: nearest palette entry for every RGB at 5 bits per
+    // channel, the SGR number of each entry, and the dither offsets added
+    // before the lookup (all zero without dithering)
+    unsigned char nearest16[32 * 32 * 32];
+    Piece code16[16];
+    int dither[4][4];
+    shared_ptr<const Palette> palette;  // adaptive palette mode
+};
+
+// One row of cells. Color mode, glyph width and run compression are
+// template parameters, so the cell loop has no branches on settings; the
+// output is written through a pointer into space reserved for the worst case.
+template <ColorMode COLOR, bool UTF8, bool REP>
+void encode_row(string& out, const CellEncoder& enc, const unsigned char* yp,
+                const unsigned char* up, const unsigned char* vp, int w, int row) {
+    // RGB for the row is converted in chunks on the stack, so the kernel
+    // keeps no state between calls
+    constexpr int CHUNK = 1024;  // even: chunks start on a chroma sample
+    unsigned char rs[COLOR != COLOR_NONE ? CHUNK : 1], gs[COLOR != COLOR_NONE ? CHUNK : 1],
+        bs[COLOR != COLOR_NONE ? CHUNK : 1];
+    // "\x1b[38;2;255;255;255m" is the longest color code
+    constexpr size_t cell_max = (COLOR == COLOR_TRUE ? 19 : COLOR == COLOR_256 || COLOR == COLOR_PALETTE ? 11 : COLOR == COLOR_16 ? 5 : 0) + (UTF8 ? 4 : 1);
+    // 16-color codes are short enough that runs of the same color are
+    // common, so they are only sent when the color changes; with REP every
+    // mode does that
+    constexpr bool SKIP_SAME_COLOR = REP || COLOR == COLOR_16;
+    const int* dither = enc.dither[row & 3];
+    int prev_color = -1;
+    uint32_t prev_glyph = 0;
+    const Piece* last = nullptr;  // glyph of the last cell written
+    int run = 0;  // cells repeating it that are not written yet
+    size_t base = out.size();
+    out.resize(base + (size_t)w * cell_max + 8);
+    char* p = &out[base];
+    // A run goes out as REP (CSI n b) when that is shorter than the glyphs;
+    // REP never costs more than the cells it replaces, so the reserve holds
+    auto flush_run = [&]() {
+        if (run * last->n <= 4) {
+            for (; run > 0; run--) {
+                memcpy(p, last->s, 4);
+                p += last->n;
+            }
+        }
+        while (run > 0) {
+            int k = min(run, 255);
+            memcpy(p, "\x1b[", 2);
+            p += 2;
+            memcpy(p, enc.decimals.dec[k].s, 4);
+            p += enc.decimals.dec[k].n;
+            *p++ = 'b';
+            run -= k;
+        }
+    };
+    for (int x0 = 0; x0 < w; x0 += CHUNK) {
+        int n = min(CHUNK, w - x0);
+        if constexpr (COLOR != COLOR_NONE) yuv_row_to_rgb(yp + x0, up + x0 / 2, vp + x0 / 2, n, rs, gs, bs);
+        for (int x = 0; x < n; x++) {
+            int color = 0;
+            if constexpr (COLOR == COLOR_TRUE) {
+                color = rs[x] << 16 | gs[x] << 8 | bs[x];
+            } else if constexpr (COLOR == COLOR_PALETTE) {
+                color = enc.palette->nearest[((rs[x] >> 3) << 10) | ((gs[x] >> 3) << 5) | (bs[x] >> 3)];
+            } else if constexpr (COLOR == COLOR_256) {
+                // 6x6x6 color cube
+                color = 16 + 36 * (rs[x] / 51) + 6 * (gs[x] / 51) + bs[x] / 51;
+            } else if constexpr (COLOR == COLOR_16) {
+                int d = dither[(x0 + x) & 3];
+                int r5 = clampi(rs[x] + d, 0, 255) >> 3, g5 = clampi(gs[x] + d, 0, 255) >> 3,
+                    b5 = clampi(bs[x] + d, 0, 255) >> 3;
+                color = enc.nearest16[(r5 << 10) | (g5 << 5) | b5];
+            }
+            const Piece& g = enc.glyph[yp[x0 + x]];
+            if constexpr (REP) {
+                // Glyphs are zero padded, so their 4 bytes identify them
+                uint32_t glyph;
+                memcpy(&glyph, g.s, 4);
+                if (last && color == prev_color && glyph == prev_glyph) {
+                    run++;
+                    continue;
+                }
+                if (run > 0) flush_run();
+                prev_glyph = glyph;
+            }
+
+            if (COLOR != COLOR_NONE && (!SKIP_SAME_COLOR || color != prev_color)) {
+                if constexpr (COLOR == COLOR_TRUE) {
+                    memcpy(p, "\x1b[38;2;", 7);
+                    p += 7;
+                    memcpy(p, enc.decimals.dec[rs[x]].s, 4);
+                    p += enc.decimals.dec[rs[x]].n;
+                    *p++ = ';';
+                    memcpy(p, enc.decimals.dec[gs[x]].s, 4);
+                    p += enc.decimals.dec[gs[x]].n;
+                    *p++ = ';';
+                    memcpy(p, enc.decimals.dec[bs[x]].s, 4);
+                    p += enc.decimals.dec[bs[x]].n;
+                    *p++ = 'm';
+                } else if constexpr (COLOR == COLOR_16) {
+                    memcpy(p, "\x1b[", 2);
+                    p += 2;
+                    memcpy(p, enc.code16[color].s, 4);
+                    p += enc.code16[color].n;
+                    *p++ = 'm';
+                } else if constexpr (COLOR != COLOR_NONE) {
+                    memcpy(p, "\x1b[38;5;", 7);
+                    p += 7;
+                    memcpy(p, enc.decimals.dec[color].s, 4);
+                    p += enc.decimals.dec[color].n;
+                    *p++ = 'm';
+                }
+            }
+            prev_color = color;
+            if constexpr (UTF8) {
+                memcpy(p, g.s, 4);
+                p += g.n;
+            } else {
+                *p++ = g.s[0];
+            }
+            last = &g;
+        }
+    }
+    if (run > 0) flush_run();
+    memcpy(p, "\x1b[0m", 4);
+    p += 4;
+    out.resize(p - out.data());
+}
+
+// Ramp position for each luma value (limited range, 16..235)
+void build_ramp(int* ramp_of, int ramp_len) {
+    for (int l = 0; l < 256; l++) {
+        ramp_of[l] = clampi((l - 16) * 255 / 219, 0, 255) * (ramp_len - 1) / 255;
+    }
+}
+
+// Split the ramp into glyphs (UTF-8 sequences, not bytes), map every luma
+// value to one and pick the kernel for the color mode and run compression
+static shared_ptr<const CellEncoder> make_cell_encoder(const RenderOptions& options) {
+    auto made = make_shared<CellEncoder>();
+    CellEncoder& enc = *made;
+    enc.color = options.truecolor ? COLOR_TRUE : options.palette ? COLOR_PALETTE : options.color256 ? COLOR_256
+              : options.color16 ? COLOR_16 : COLOR_NONE;
+    enc.palette = options.palette;
+
+    vector<string> glyphs;
+    for (size_t i = 0; i < options.chars.size();) {
+        unsigned char c = options.chars[i];
+        size_t n = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 1;
+        n = min(n, options.chars.size() - i);
+        glyphs.push_back(options.chars.substr(i, n));
+        if (n > 1) enc.utf8 = true;
+        i += n;
+    }
+    if (glyphs.empty()) glyphs.push_back(" ");
+
+    int ramp_of[256];
+    build_ramp(ramp_of, glyphs.size());
+    for (int l = 0; l < 256; l++) {
+        const string& g = glyphs[ramp_of[l]];
+        memset(enc.glyph[l].s, 0, 4);
+        memcpy(enc.glyph[l].s, g.data(), g.size());
+        enc.glyph[l].n = g.size();
+    }
+
+    static const RowKernel kernels[5][2][2] = {
+        {{encode_row<COLOR_NONE, false, false>, encode_row<COLOR_NONE, false, true>},
+         {encode_row<COLOR_NONE, true, false>, encode_row<COLOR_NONE, true, true>}},
+        {{encode_row<COLOR_16, false, false>, encode_row<COLOR_16, false, true>},
+         {encode_row<COLOR_16, true, false>, encode_row<COLOR_16, true, true>}},
+        {{encode_row<COLOR_256, false, false>, encode_row<COLOR_256, false, true>},
+         {encode_row<COLOR_256, true, false>, encode_row<COLOR_256, true, true>}},
+        {{encode_row<COLOR_PALETTE, false, false>, encode_row<COLOR_PALETTE, false, true>},
+         {encode_row<COLOR_PALETTE, true, false>, encode_row<COLOR_PALETTE, true, true>}},
+        {{encode_row<COLOR_TRUE, false, false>, encode_row<COLOR_TRUE, false, true>},
+         {encode_row<COLOR_TRUE, true, false>, encode_row<COLOR_TRUE, true, true>}},
+    };
+    enc.row = kernels[enc.color][enc.utf8][options.rep];
+
+    if (enc.color == COLOR_16) {
+        // Nearest by squared distance, green weighted most as the eye is
+        // most sensitive to it; evaluated at the centre of each 5-bit bin
+        for (int i = 0; i < 32 * 32 * 32; i++) {
+            int r = ((i >> 10) << 3) + 4, g = (((i >> 5) & 31) << 3) + 4, b = ((i & 31) << 3) + 4;
+            int best = 0, best_dist = INT_MAX;
+            for (int c = 0; c < 16; c++) {
+                int dr = r - PALETTE16[c][0], dg = g - PALETTE16[c][1], db = b - PALETTE16[c][2];
+                int dist = 3 * dr * dr + 4 * dg * dg + 2 * db * db;
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = c;
+                }
+            }
+            enc.nearest16[i] = best;
+        }
+        for (int c = 0; c < 16; c++) enc.code16[c] = enc.decimals.dec[c < 8 ? 30 + c : 90 + c - 8];
+    }
+    // Offsets of up to +-60, about half the gap between palette levels
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) enc.dither[y][x] = options.dither ? (BAYER4[y][x] * 2 - 15) * 4 : 0;
+    }
+    return made;
+}
+
+void sample_rgb(const YuvView& frame, int width, int height, int step, vector<unsigned char>& rgb) {
+    rgb.clear();
+    vector<unsigned char> line((size_t)width * 3);
+    for (int row = 0; row < cell_rows(height); row += step) {
+        size_t c_off = row * frame.c_stride;
+        unsigned char *r = line.data(), *g = r + width, *b = g + width;
+        yuv_row_to_rgb(frame.y + row * frame.y_stride, frame.u + c_off, frame.v + c_off, width, r, g, b);
+        for (int x = 0; x < width; x += step) {
+            rgb.push_back(r[x]);
+            rgb.push_back(g[x]);
+            rgb.push_back(b[x]);
+        }
+    }
+}
+
+// Median cut: start with one box holding every sample and keep splitting
+// the box with the widest channel range at its median along that channel.
+// Each box becomes the average of its samples.
+shared_ptr<const Palette> make_palette(const vector<unsigned char>& rgb) {
+    auto made = make_shared<Palette>();
+    Palette& pal = *made;
+    memcpy(pal.rgb, PALETTE16, sizeof(PALETTE16));
+
+    size_t n = rgb.size() / 3;
+    vector<array<unsigned char, 3>> px(n);
+    for (size_t i = 0; i < n; i++) px[i] = {rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]};
+    struct Box {
+        size_t begin, end;
+        int channel, range;  // widest channel and its range
+    };
+    auto measure = [&](Box& box) {
+        unsigned char lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+        for (size_t i = box.begin; i < box.end; i++) {
+            for (int c = 0; c < 3; c++) {
+                lo[c] = min(lo[c], px[i][c]);
+                hi[c] = max(hi[c], px[i][c]);
+            }
+        }
+        box.channel = 0;
+        for (int c = 1; c < 3; c++) {
+            if (hi[c] - lo[c] > hi[box.channel] - lo[box.channel]) box.channel = c;
+        }
+        box.range = box.end - box.begin > 1 ? hi[box.channel] - lo[box.channel] : 0;
+    };
+    vector<Box> boxes;
+    if (n > 0) {
+        boxes.push_back({0, n, 0, 0});
+        measure(boxes[0]);
+    }
+    while (boxes.size() < (size_t)(256 - 16)) {
+        size_t widest = 0;
+        for (size_t i = 1; i < boxes.size(); i++) {
+            if (boxes[i].range > boxes[widest].range) widest = i;
+        }
+        Box& box = boxes[widest];
+        if (box.range == 0) break;  // every box is a single color
+        int c = box.channel;
+        size_t mid = box.begin + (box.end - box.begin) / 2;
+        nth_element(px.begin() + box.begin, px.begin() + mid, px.begin() + box.end,
+                    [c](const array<unsigned char, 3>& a, const array<unsigned char, 3>& b) { return a[c] < b[c]; });
+        Box upper = {mid, box.end, 0, 0};
+        box.end = mid;
+        measure(box);
+        measure(upper);
+        boxes.push_back(upper);
+    }
+
+    pal.count = 16 + boxes.size();
+    for (size_t i = 0; i < boxes.size(); i++) {
+        size_t sum[3] = {0, 0, 0};
+        for (size_t k = boxes[i].begin; k < boxes[i].end; k++) {
+            for (int c = 0; c < 3; c++) sum[c] += px[k][c];
+        }
+        size_t count = boxes[i].end - boxes[i].begin;
+        for (int c = 0; c < 3; c++) pal.rgb[16 + i][c] = (sum[c] + count / 2) / count;
+    }
+
+    // Only the scene's own entries are used, so the basic 16 (which the
+    // rest of the screen may use) never change meaning
+    int first = pal.count > 16 ? 16 : 0;
+    for (int i = 0; i < 32 * 32 * 32; i++) {
+        int r = ((i >> 10) << 3) + 4, g = (((i >> 5) & 31) << 3) + 4, b = ((i & 31) << 3) + 4;
+        int best = first, best_dist = INT_MAX;
+        for (int e = first; e < pal.count; e++) {
+            int dr = r - pal.rgb[e][0], dg = g - pal.rgb[e][1], db = b - pal.rgb[e][2];
+            int dist = 3 * dr * dr + 4 * dg * dg + 2 * db * db;
+            if (dist < best_dist) {
+                best_dist = dist;
+                best = e;
+            }
+        }
+        pal.nearest[i] = best;
+    }
+    return made;
+}
+
+string palette_osc(const Palette& palette) {
+    if (palette.count <= 16) return "";
+    string osc = "\x1b]4";
+    char entry[32];
+    for (int i = 16; i < palette.count; i++) {
+        snprintf(entry, sizeof(entry), ";%d;rgb:%02x/%02x/%02x", i, palette.rgb[i][0], palette.rgb[i][1], palette.rgb[i][2]);
+        osc += entry;
+    }
+    osc += "\x1b\\";
+    return osc;
+}
+
+static const int SCENE_SAMPLES = 4096;  // cells sampled per frame, about
+static const double SCENE_CHANGE = 0.3;  // share of the color histogram that moved
+
+static void scene_palette_worker(ScenePalette* sp) {
+    unique_lock<mutex> lk(sp->m);
+    while (true) {
+        sp->wake.wait(lk, [&]() { return sp->stop || sp->job_pending; });
+        if (sp->stop) break;
+        vector<unsigned char> job = move(sp->job);
+        sp->job_pending = false;
+        lk.unlock();
+        shared_ptr<const Palette> palette = make_palette(job);
+        lk.lock();
+        sp->ready = palette;
+    }
+}
+
+void scene_palette_start(ScenePalette& sp) {
+    sp.worker = thread(scene_palette_worker, &sp);
+}
+
+void scene_palette_stop(ScenePalette& sp) {
+    if (!sp.worker.joinable()) return;
+    {
+        lock_guard<mutex> lk(sp.m);
+        sp.stop = true;
+    }
+    sp.wake.notify_one();
+    sp.worker.join();
+}
+
+ScenePalette::~ScenePalette() { scene_palette_stop(*this); }
+
+bool scene_palette_update(ScenePalette& sp, const YuvView& frame, int w, int h) {
+    int step = max(1, (int)sqrt((double)w * cell_rows(h) / SCENE_SAMPLES));
+    sample_rgb(frame, w, h, step, sp.samples);
+    size_t n = sp.samples.size() / 3;
+    if (n == 0) return false;
+    array<double, 64> hist{};
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char* c = &sp.samples[3 * i];
+        hist[(c[0] >> 6) << 4 | (c[1] >> 6) << 2 | c[2] >> 6] += 1.0 / n;
+    }
+    double moved = 0.0;
+    for (int b = 0; b < 64; b++) moved += fabs(hist[b] - sp.scene_hist[b]);
+
+    lock_guard<mutex> lk(sp.m);
+    if (!sp.has_scene || moved / 2 > SCENE_CHANGE) {
+        sp.scene_hist = hist;
+        sp.has_scene = true;
+        sp.job = sp.samples;
+        sp.job_pending = true;
+        sp.wake.notify_one();
+    }
+    if (!sp.ready) return false;
+    sp.current = move(sp.ready);
+    sp.ready = nullptr;
+    sp.changes++;
+    return true;
+}
+
+Renderer::Renderer() : Renderer(RenderOptions()) {}
+
+Renderer::Renderer(const RenderOptions& options) : options_(options), enc_(make_cell_encoder(options)) {}
+
+// Encode terminal row `row` of a frame (luma line 2*row). Full frames and
+// compact (sampled) ones differ only in the view's strides.
+void Renderer::render_row(string& out, const YuvView& frame, int row) const {
+    size_t c_off = row * frame.c_stride;
+    enc_->row(out, *enc_, frame.y + row * frame.y_stride, frame.u + c_off, frame.v + c_off, options_.width, row);
+}
+
+// Offset frames start every row with a cursor move rather than padding
+// it with blanks
+void Renderer::render(string& out, const YuvView& frame, int x_offset, int y_offset) const {
+    out.clear();
+    bool offset = x_offset > 0 || y_offset > 0;
+    if (!offset) out += "\x1b[H";
+    for (int r = 0; r < cell_rows(options_.height); r++) {
+        if (offset) out += "\x1b[" + to_string(max(0, y_offset) + r + 1) + ";" + to_string(max(0, x_offset) + 1) + "H";
+        render_row(out, frame, r);
+        if (!offset) out += '\n';
+    }
+}
+
+void Renderer::render_rows(string& out, const YuvView& frame, int x_offset, int y_offset,
+                           const vector<bool>& rows) const {
+    out.clear();
+    for (int r = 0; r < cell_rows(options_.height) && r < (int)rows.size(); r++) {
+        if (!rows[r]) continue;
+        out += "\x1b[" + to_string(max(0, y_offset) + r + 1) + ";" + to_string(max(0, x_offset) + 1) + "H";
+        render_row(out, frame, r);
+    }
+}
+
+void Renderer::render_tile(string& out, const YuvView& frame, int left, int top) const {
+    out.clear();
+    for (int r = 0; r < cell_rows(options_.height); r++) {
+        out += "\x1b[" + to_string(top + r + 1) + ";" + to_string(left + 1) + "H";
+        render_row(out, frame, r);
+    }
+}
+
+// Keep held where the new sample is within threshold of it. Adds the
+// samples that changed but were kept to kept; true if any was replaced.
+// SSE2 does 16 samples per step: |a - b| from two saturating subtractions,
+// then a blend.
+static bool hold_row(unsigned char* held, const unsigned char* src, int n, int threshold, int64_t& kept) {
+    bool moved = false;
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128(), limit = _mm_set1_epi8((char)threshold);
+    for (; x + 16 <= n; x += 16) {
+        __m128i old = _mm_loadu_si128((const __m128i*)(held + x));
+        __m128i cur = _mm_loadu_si128((const __m128i*)(src + x));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(old, cur), _mm_subs_epu8(cur, old));
+        __m128i keep = _mm_cmpeq_epi8(_mm_subs_epu8(diff, limit), zero);
+        _mm_storeu_si128((__m128i*)(held + x), _mm_or_si128(_mm_and_si128(keep, old), _mm_andnot_si128(keep, cur)));
+        int same = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, zero));
+        int kept_mask = _mm_movemask_epi8(keep);
+        kept += __builtin_popcount(kept_mask & ~same);
+        moved |= kept_mask != 0xffff;
+    }
+#endif
+    for (; x < n; x++) {
+        int diff = abs(held[x] - src[x]);
+        if (diff > threshold) {
+            held[x] = src[x];
+            moved = true;
+        } else if (diff > 0) {
+            kept++;
+        }
+    }
+    return moved;
+}
+
+YuvView Stabilizer::apply(const YuvView& frame, int w, int h) {
+    if (w != w_ || h != h_) {
+        w_ = w;
+        h_ = h;
+        picture_.resize(compact_frame_bytes(w, h));
+        changed_.assign(cell_rows(h), true);
+        valid_ = false;
+    }
+    YuvView out = compact_view(picture_.data(), w, h);
+    int rows = cell_rows(h), cw = chroma_width(w);
+    for (int r = 0; r < rows; r++) {
+        bool moved = !valid_;
+        unsigned char* planes[3] = {(unsigned char*)out.y + r * out.y_stride, (unsigned char*)out.u + r * out.c_stride,
+                                    (unsigned char*)out.v + r * out.c_stride};
+        const unsigned char* src[3] = {frame.y + r * frame.y_stride, frame.u + r * frame.c_stride,
+                                       frame.v + r * frame.c_stride};
+        int widths[3] = {w, cw, cw};
+        for (int p = 0; p < 3; p++) {
+            if (valid_) moved |= hold_row(planes[p], src[p], widths[p], threshold_, held);
+            else memcpy(planes[p], src[p], widths[p]);
+            samples += widths[p];
+        }
+        changed_[r] = moved;
+    }
+    valid_ = true;
+    return out;
+}
+
+static bool write_all(int fd, const char* data, size_t size) {
+    size_t off = 0;
+    while (off < size) {
+        ssize_t n = write(fd, data + off, size - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                fd_set wfds;
+                FD_ZERO(&wfds);
+                FD_SET(fd, &wfds);
+                select(fd + 1, nullptr, &wfds, nullptr, nullptr);
+                continue;
+            }
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
+
+// Single producer (the caller), single consumer (the writer thread): the
+// buffers change hands through the two counters alone. A side that has to
+// wait for the other raises its flag and sleeps on the mutex; the other
+// side takes the mutex and notifies only when it sees that flag. The
+// counters and flags are sequentially consistent, so either the sleeper
+// sees the new count or the other side sees the flag.
+struct Presenter::Writer {
+    vector<string> slots;
+    atomic<uint64_t> queued{0}, written{0};
+    atomic<bool> failed{false};
+    atomic<bool> producer_waiting{false}, consumer_waiting{false};
+    bool stopping = false;  // under m
+    mutex m;
+    condition_variable cv;
+    thread worker;
+
+    // Sleep until ready() holds; the producer's side of the handoff
+    template <class Ready> void producer_wait(Ready ready) {
+        unique_lock<mutex> lock(m);
+        producer_waiting.store(true);
+        cv.wait(lock, ready);
+        producer_waiting.store(false);
+    }
+
+    // Wake the other side if it is asleep
+    void wake(atomic<bool>& waiting) {
+        if (!waiting.load()) return;
+        { lock_guard<mutex> lock(m); }
+        cv.notify_all();
+    }
+
+    // Wait for a free slot and return it; the caller fills it and publishes it
+    string& slot() {
+        uint64_t q = queued.load(memory_order_relaxed);
+        if (q - written.load(memory_order_acquire) >= slots.size()) {
+            producer_wait([&]() { return q - written.load() < slots.size(); });
+        }
+        return slots[q % slots.size()];
+    }
+
+    void publish() {
+        queued.store(queued.load(memory_order_relaxed) + 1);
+        wake(consumer_waiting);
+    }
+
+    void run(int fd) {
+        for (;;) {
+            uint64_t i = written.load(memory_order_relaxed);
+            if (queued.load(memory_order_acquire) == i) {
+                unique_lock<mutex> lock(m);
+                consumer_waiting.store(true);
+                cv.wait(lock, [&]() { return queued.load() != i || stopping; });
+                consumer_waiting.store(false);
+                if (queued.load(memory_order_acquire) == i) return;  // stopping, all written
+            }
+            string& frame = slots[i % slots.size()];
+            // After a failed write the rest is dropped, so the caller never
+            // blocks on a dead terminal
+            if (!failed.load(memory_order_relaxed) && !write_all(fd, frame.data(), frame.size())) {
+                failed.store(true, memory_order_relaxed);
+            }
+            frame.clear();
+            written.store(i + 1);
+            wake(producer_waiting);
+        }
+    }
+};
+
+Presenter::Presenter(int out_fd, int in_fd) : out_fd_(out_fd), in_fd_(in_fd) {}
+
+Presenter::~Presenter() {
+    leave();
+    stop_writer();
+}
+
+void Presenter::start_writer(int buffers) {
+    if (writer_) return;
+    writer_.reset(new Writer());
+    writer_->slots.resize(max(1, buffers));
+    writer_->worker = thread(&Writer::run, writer_.get(), out_fd_);
+}
+
+void Presenter::stop_writer() {
+    if (!writer_) return;
+    {
+        lock_guard<mutex> lock(writer_->m);
+        writer_->stopping = true;
+    }
+    writer_->cv.notify_all();
+    writer_->worker.join();
+    writer_.reset();
+}
+
+bool Presenter::submit(string& frame) {
+    if (!writer_) return present(frame);
+    writer_->slot().swap(frame);
+    writer_->publish();
+    return !writer_->failed.load(memory_order_relaxed);
+}
+
+void Presenter::flush() {
+    if (!writer_) return;
+    writer_->producer_wait([&]() { return writer_->written.load() == writer_->queued.load(memory_order_relaxed); });
+}
+
+void Presenter::enter() {
+    if (entered_) return;
+    tcgetattr(in_fd_, &saved_);
+    struct termios raw = saved_;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    tcsetattr(in_fd_, TCSANOW, &raw);
+    present("\x1b[?25l");
+    entered_ = true;
+}
+
+void Presenter::leave() {
+    if (!entered_) return;
+    tcsetattr(in_fd_, TCSANOW, &saved_);
+    present("\x1b[0m\x1b[?25h");
+    flush();  // what follows (messages, the shell prompt) comes after the last frame
+    entered_ = false;
+}
+
+void Presenter::clear() {
+    present("\x1b[2J\x1b[H");
+}
+
+bool Presenter::present(const char* data, size_t size) {
+    if (!writer_) return write_all(out_fd_, data, size);
+    writer_->slot().assign(data, size);
+    writer_->publish();
+    return !writer_->failed.load(memory_order_relaxed);
+}
+
+}  // namespace mta
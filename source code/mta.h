@@ -0,0 +1,404 @@
+// mta.h
+// Render core of the mta player, usable on its own: decode video to yuv420p
+// at the output size (mta::Decoder), encode frames as ANSI text into a
+// caller-owned buffer (mta::Renderer) and put them on a terminal
+// (mta::Presenter), along with what a player needs around them: audio and
+// the clock video follows, frame stores for loops and rewinding, black bar
+// detection and scene palettes. No global state: every object can be used
+// from its own thread, and any number of them can exist at once.
+// Build: make libmta.a (or compile mta.cpp along with your program)
+#ifndef MTA_H
+#define MTA_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+#include <termios.h>
+
+namespace mta {
+
+// Decoded frames are yuv420p. The renderer only samples every other line
+// (2 video lines per terminal row), so terminal row r uses luma line 2r and
+// chroma line r. Frames kept in memory store just those luma lines plus
+// the chroma planes.
+struct YuvView {
+    const unsigned char* y = nullptr;
+    size_t y_stride = 0;  // bytes between sampled luma lines
+    const unsigned char* u = nullptr;
+    const unsigned char* v = nullptr;
+    size_t c_stride = 0;
+};
+
+// Sizes are in video pixels: w x h becomes w x (h/2) terminal cells
+int chroma_width(int w);
+int cell_rows(int h);
+size_t chroma_bytes(int w, int h);
+size_t yuv_frame_bytes(int w, int h);      // a whole decoded frame
+size_t compact_frame_bytes(int w, int h);  // sampled luma lines + chroma, see pack_rows()
+YuvView full_view(const unsigned char* frame, int w, int h);
+YuvView compact_view(const unsigned char* frame, int w, int h);
+// Copy the lines the renderer samples out of a whole frame
+void pack_rows(unsigned char* dst, const unsigned char* src, int w, int h);
+// BT.601 limited range YUV to RGB for one row, chroma at half width
+void yuv_row_to_rgb(const unsigned char* yp, const unsigned char* up, const unsigned char* vp, int w,
+                    unsigned char* r, unsigned char* g, unsigned char* b);
+// Hash of what the cells of a w x h frame are drawn from (the sampled
+// luma lines and the chroma rows): equal hashes mean an identical screen
+uint64_t frame_hash(const YuvView& frame, int w, int h);
+int clampi(int v, int lo, int hi);
+
+// Child process whose stdout is read through a non-blocking pipe, or (with
+// feed) whose stdin we write to through a blocking one. argv[0] is looked up
+// in PATH and run without a shell, so file names reach it untouched.
+struct Child {
+    pid_t pid = -1;
+    int fd = -1;
+};
+enum ChildStderr { STDERR_INHERIT, STDERR_NULL, STDERR_PIPE };  // STDERR_PIPE: onto the stdout pipe
+Child spawn_child(const std::vector<std::string>& argv, bool feed = false, ChildStderr err = STDERR_INHERIT);
+void stop_child(Child& child);
+// Read a child's output to EOF, waiting for it as needed
+std::string read_child_output(Child& child);
+// ffmpeg arguments reading input from position (seconds)
+std::vector<std::string> decoder_args(const std::string& infile, const std::vector<std::string>& input_args,
+                                      const std::vector<std::string>& output_args, double position);
+
+// Part of the source picture that is played, in source pixels
+struct CropArea {
+    int x = 0, y = 0, w = 0, h = 0;  // w = 0: the whole picture
+};
+
+// Black bars are found by ffmpeg's cropdetect on a few frames at each of
+// several positions. crop_cancel() stops a detect_crop() running on another
+// thread, along with its ffmpeg.
+struct CropCancel {
+    std::mutex m;
+    bool cancelled = false;
+    pid_t pid = -1;  // the ffmpeg running now
+};
+void crop_cancel(CropCancel& cancel);
+// The union of the areas found at the positions (source seconds), so one
+// dark shot can't crop away real picture. Empty if nothing was found.
+CropArea detect_crop(const std::string& file, const std::vector<double>& positions, CropCancel* cancel);
+// The union of two areas of a picture (an empty area is the whole picture)
+CropArea crop_union(CropArea a, CropArea b);
+// Whether two areas of a video_w x video_h picture differ by more than 2%
+// of its width or height on any edge (an empty area is the whole picture)
+bool crop_differs(CropArea a, CropArea b, int video_w, int video_h);
+// The part of area (the whole video_w x video_h picture when empty) seen at
+// zoom around (cx, cy), given as fractions of area. The centre is pulled in
+// so the view stays inside area; sizes and offsets are even to keep the
+// chroma planes aligned.
+CropArea zoom_area(CropArea area, int video_w, int video_h, double zoom, double& cx, double& cy);
+
+// What a decoder produces
+struct DecodeSettings {
+    std::string input;  // file, URL or pipe:N
+    int width = 0, height = 0;  // output size in pixels
+    std::string filter;  // ffmpeg -vf chain ahead of the final scaling (pipe backend)
+    bool live = false;  // low-latency input, timestamps kept as the source sent them
+    // Part of the source picture to decode (source pixels), cropped before
+    // scaling; crop_w = 0 is the whole picture
+    int crop_x = 0, crop_y = 0, crop_w = 0, crop_h = 0;
+};
+
+// Source of decoded yuv420p frames at the output size. fd() becomes readable
+// when read_frame() can make progress, so an event loop can treat every
+// backend like a pipe.
+class Decoder {
+public:
+    virtual ~Decoder() {}
+    virtual const char* name() const = 0;
+    virtual int fd() const = 0;
+    // (Re)start decoding at a source position
+    virtual bool start(const DecodeSettings& settings, double position, bool keyframes_only) = 0;
+    // Read into dst (yuv_frame_bytes() long): 1 = frame complete with its
+    // timestamp in pts, 0 = would block, -1 = end of stream or error
+    virtual int read_frame(unsigned char* dst, size_t size, double& pts) = 0;
+    virtual void stop() = 0;
+};
+
+bool has_libav();  // built with -DMTA_LIBAV
+// Create and start a decoder. backend is "libav", "pipe" (ffmpeg child
+// process) or empty: libav when built in, falling back to the pipe for
+// inputs it can't open. nullptr if it can't start, or for "libav" in a
+// build without it.
+std::unique_ptr<Decoder> open_decoder(const std::string& backend, const DecodeSettings& settings,
+                                      double position, bool keyframes_only);
+
+// Decoded frames of a short clip kept in memory so it can be replayed
+// without restarting the decoder. Filled during the first pass from the
+// start of the clip; given up (and the memory released) once the clip
+// exceeds the budget.
+struct LoopCache {
+    size_t budget = 0;  // bytes, 0 = disabled
+    size_t frame_bytes = 0;  // compact frame size, see pack_rows()
+    size_t frames = 0;
+    bool overflow = false;
+    std::vector<unsigned char> arena;  // frames back to back
+    std::vector<double> times;  // presentation time of each frame
+
+    const unsigned char* frame(size_t i) const { return arena.data() + i * frame_bytes; }
+};
+void loop_cache_reset(LoopCache& cache, size_t frame_bytes, size_t expected_frames);
+// Pack a whole w x h frame into the cache; false once it has overflowed
+bool loop_cache_add(LoopCache& cache, const unsigned char* frame, int w, int h, double time);
+
+// Fixed-capacity ring of recently shown frames, so short seeks and frame
+// stepping are served from memory instead of restarting the decoder.
+// Timestamps are increasing from the oldest slot to the newest one.
+struct RewindRing {
+    size_t slot_bytes = 0;  // compact frame size, see pack_rows()
+    size_t capacity = 0;    // slots
+    size_t head = 0;        // next slot to write
+    size_t count = 0;
+    std::vector<unsigned char> slots;
+    std::vector<double> times;  // presentation time of each slot
+
+    // i = 0 is the oldest frame
+    size_t slot(size_t i) const { return (head + capacity - count + i) % capacity; }
+    const unsigned char* frame(size_t i) const { return slots.data() + slot(i) * slot_bytes; }
+};
+void ring_reset(RewindRing& ring, size_t slot_bytes, size_t budget);
+// Pack a whole w x h frame into the next slot, over the oldest when full
+void ring_push(RewindRing& ring, const unsigned char* frame, int w, int h, double time);
+// Index of the last frame shown at or before t, or -1 if t is not covered
+long ring_find(const RewindRing& ring, double t);
+
+// Look up an executable in PATH without spawning a shell
+bool in_path(const std::string& prog);
+
+// Audio is decoded by its own ffmpeg to raw PCM in this format
+const int AUDIO_RATE = 48000;
+const int AUDIO_CHANNELS = 2;
+const double AUDIO_BYTE_RATE = AUDIO_RATE * AUDIO_CHANNELS * 2.0;  // s16le
+
+// Where decoded audio goes. write() blocks at playback pace, so what was
+// written minus latency() is what has actually been heard.
+struct AudioSink {
+    virtual ~AudioSink() {}
+    virtual bool open() = 0;
+    virtual bool write(const char* data, size_t bytes) = 0;
+    virtual double latency() = 0;  // seconds written but not played yet
+    virtual void flush() = 0;      // drop everything not played yet
+    virtual void close() = 0;
+};
+// "pulse" (pacat), "alsa" (aplay), "null" or "file:PATH"; empty picks the
+// first one available. nullptr for an unknown name or a player that isn't
+// installed: the pipe to it would open fine and the sound go nowhere.
+std::unique_ptr<AudioSink> make_audio_sink(const std::string& name);
+// ffmpeg -af chain for a playback speed (atempo takes 0.5..2 per instance)
+std::string atempo_filter(float speed);
+
+enum AudioState { AUDIO_OFF, AUDIO_STARTING, AUDIO_PLAYING, AUDIO_ENDED };
+
+// Audio of a source: an ffmpeg decoding PCM at the playback speed and a
+// thread feeding it to the sink. The thread publishes the source position
+// of what is being heard; that is the clock video can follow.
+struct AudioPlayer {
+    std::unique_ptr<AudioSink> sink;
+    Child decoder;
+    std::thread worker;
+    std::atomic<bool> stop{false};
+
+    std::mutex lock;  // guards the fields below
+    AudioState state = AUDIO_OFF;
+    double start_pos = 0.0;
+    float speed = 1.0f;
+    double pos = 0.0;  // source position heard at `at`
+    std::chrono::steady_clock::time_point at;
+};
+// (Re)start audio at a source position; false if ffmpeg can't be started
+bool audio_start(AudioPlayer& ap, const std::string& infile, double position, float speed);
+void audio_stop(AudioPlayer& ap);
+// Source position being heard now; t is only set once audio is audible
+AudioState audio_clock(AudioPlayer& ap, double& t);
+
+// Source position of playback. Runs at speed from the position last set;
+// while audio is set and audible, the position being heard is the clock,
+// and once that audio ends the wall clock goes on from where it stopped.
+// Pausing is up to the caller: read base() instead of now().
+class MediaClock {
+public:
+    void set(double t);  // the position is t now
+    double now();
+    double base() const { return base_; }  // the position last set
+
+    float speed = 1.0f;
+    AudioPlayer* audio = nullptr;  // followed while set; cleared when it ends
+
+private:
+    double base_ = 0.0;
+    std::chrono::steady_clock::time_point wall_ = std::chrono::steady_clock::now();
+};
+
+// A 256-color terminal palette fitted to a scene: entries 16 up to count
+// are the scene's colors, 0-15 stay the basic colors. nearest maps RGB at
+// 5 bits per channel (r << 10 | g << 5 | b) to the closest scene entry.
+struct Palette {
+    unsigned char rgb[256][3];
+    int count = 16;
+    unsigned char nearest[32 * 32 * 32];
+};
+
+// RGB of every step-th cell of every step-th terminal row of a frame
+void sample_rgb(const YuvView& frame, int width, int height, int step, std::vector<unsigned char>& rgb);
+// Median cut over RGB samples (3 bytes each) and the lookup table. Takes
+// tens of milliseconds: run it off the render thread.
+std::shared_ptr<const Palette> make_palette(const std::vector<unsigned char>& rgb);
+// OSC 4 sequence that programs the terminal with the palette's scene colors
+std::string palette_osc(const Palette& palette);
+// OSC 104: back to the terminal's own palette
+constexpr const char* PALETTE_RESET = "\x1b]104\x1b\\";
+
+// A palette that follows the scene. Every frame about to be shown is
+// sampled; when its colors differ enough from the frame that started the
+// scene, a worker thread fits a new palette to it, and the next
+// scene_palette_update() takes it into use.
+struct ScenePalette {
+    std::thread worker;
+    std::mutex m;
+    std::condition_variable wake;
+    std::vector<unsigned char> job;  // samples of the frame that started a scene
+    bool job_pending = false;
+    bool stop = false;
+    std::shared_ptr<const Palette> ready;  // computed, not in use yet
+    std::shared_ptr<const Palette> current;
+    std::vector<unsigned char> samples;
+    std::array<double, 64> scene_hist{};  // 4x4x4 RGB histogram of the scene's first frame
+    bool has_scene = false;
+    int changes = 0;
+
+    ~ScenePalette();
+};
+void scene_palette_start(ScenePalette& sp);
+void scene_palette_stop(ScenePalette& sp);
+// Check a w x h frame about to be shown. Returns true when a new palette
+// has been taken into use: its OSC 4 sequence must go out before the frame.
+bool scene_palette_update(ScenePalette& sp, const YuvView& frame, int w, int h);
+
+// How frames are encoded
+struct RenderOptions {
+    int width = 0, height = 0;  // frame size in pixels
+    std::string chars = " .:-=+*#%@";  // dark to light; UTF-8 glyphs are fine
+    bool color16 = false;  // the basic colors: shortest codes, for slow links
+    bool dither = false;  // ordered dither for color16
+    bool color256 = false;  // wins over color16
+    bool truecolor = false;  // wins over color256
+    // 256-color codes index this palette instead of the standard one; the
+    // terminal has to be programmed with palette_osc() first. Wins over
+    // color256 and color16, not over truecolor.
+    std::shared_ptr<const Palette> palette;
+    // Send color codes only when the color changes and collapse runs of
+    // identical cells with REP (CSI n b). Needs a terminal that has REP.
+    bool rep = false;
+};
+
+// Ramp position for each luma value (limited range, 16..235)
+void build_ramp(int* ramp_of, int ramp_len);
+
+struct CellEncoder;
+
+// Encodes frames into ANSI text. The tables and the cell kernel for the
+// options are set up once in the constructor; rendering itself only reads
+// them, so one Renderer can serve several threads.
+class Renderer {
+public:
+    Renderer();
+    explicit Renderer(const RenderOptions& options);
+    const RenderOptions& options() const { return options_; }
+
+    // A whole screen: the frame with its top-left corner at cell
+    // (x_offset, y_offset). out is cleared but keeps its capacity.
+    void render(std::string& out, const YuvView& frame, int x_offset, int y_offset) const;
+    // The frame in its own rectangle at cell (left, top): every row starts
+    // with a cursor move, so tiles can be appended to one buffer in any order
+    void render_tile(std::string& out, const YuvView& frame, int left, int top) const;
+    // Only the rows flagged in rows, each after a cursor move: brings a
+    // screen that shows the previous frame at the same place up to date
+    void render_rows(std::string& out, const YuvView& frame, int x_offset, int y_offset,
+                     const std::vector<bool>& rows) const;
+    // Append terminal row `row` of a frame
+    void render_row(std::string& out, const YuvView& frame, int row) const;
+
+private:
+    RenderOptions options_;
+    std::shared_ptr<const CellEncoder> enc_;
+};
+
+// Temporal hysteresis ahead of a Renderer. A sample of the picture (the
+// luma and chroma a cell is drawn from) keeps its held value until a new
+// frame moves it by more than threshold, so noise and compression
+// artifacts don't flip glyphs and colors every frame. Real changes come
+// through whole; slow fades move in steps of threshold. Rows where nothing
+// moved can be left alone on screen (Renderer::render_rows()).
+class Stabilizer {
+public:
+    explicit Stabilizer(int threshold = 0) : threshold_(threshold) {}
+    int threshold() const { return threshold_; }
+
+    // Fold a w x h frame into the held picture and return it (compact
+    // layout, valid until the next call). The first frame, and the first
+    // after reset() or a size change, is taken as it is.
+    YuvView apply(const YuvView& frame, int w, int h);
+    void reset() { valid_ = false; }
+    // Terminal rows of the last frame where a sample moved
+    const std::vector<bool>& changed_rows() const { return changed_; }
+    int64_t samples = 0, held = 0;  // samples seen, and those that changed but were held
+
+private:
+    int threshold_;
+    int w_ = 0, h_ = 0;
+    bool valid_ = false;
+    std::vector<unsigned char> picture_;
+    std::vector<bool> changed_;
+};
+
+// A terminal the frames go to. enter() switches the input side to raw mode
+// and hides the cursor; leave() (or the destructor) restores both.
+class Presenter {
+public:
+    explicit Presenter(int out_fd = 1, int in_fd = 0);
+    ~Presenter();
+    Presenter(const Presenter&) = delete;
+    Presenter& operator=(const Presenter&) = delete;
+
+    void enter();
+    void leave();
+    void clear();
+    // Write the whole buffer, waiting on a slow terminal; false on error
+    bool present(const std::string& frame) { return present(frame.data(), frame.size()); }
+    bool present(const char* data, size_t size);
+
+    // Pipelined output: a writer thread drains one frame while the caller
+    // encodes the next. Up to `buffers` frames are queued (2 = double
+    // buffering); after that the caller waits for the terminal. present()
+    // copies into the queue, submit() swaps the frame for a free buffer
+    // instead. Everything goes out in order.
+    void start_writer(int buffers = 2);
+    void stop_writer();  // writes out what is queued first
+    // Hand a frame over: it comes back empty (a drained buffer, capacity
+    // kept). Without a writer this is present(). False once a write failed.
+    bool submit(std::string& frame);
+    void flush();  // wait until everything queued is on the terminal
+
+private:
+    struct Writer;
+    int out_fd_, in_fd_;
+    struct termios saved_ = {};
+    bool entered_ = false;
+    std::unique_ptr<Writer> writer_;
+};
+
+}  // namespace mta
+
+#endif
@@ -1,8 +1,11 @@
-// mta_v2.cpp
+// mta16.cpp: the mta player
 // Stable terminal ASCII/ANSI video player with optional audio (-A) and sound effects (-S)
-// Build: g++ -O2 -std=c++17 -pthread -o mta mta_v2.cpp
-// Requires: ffmpeg, ffplay installed and in PATH
+// Decoding, encoding and output are the mta library (mta.h); this is the player around it
+// Build: make (or g++ -O2 -std=c++17 -pthread -o mta mta16.cpp mta.cpp)
+// In-process decoding: make LIBAV=1
+// Requires: ffmpeg installed and in PATH (pacat or aplay for audio)
 
+#include "mta.h"
 #include <bits/stdc++.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
@@ -12,8 +15,23 @@
 #include <thread>
 #include <fcntl.h>
 #include <cmath>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 using namespace std;
+using namespace mta;
 
 volatile sig_atomic_t g_stop = 0;
 void onint(int){ g_stop = 1; }
@@ -73,7 +91,13 @@ const Preset PRESET_VERTICAL_2K = {1080, 1920, CHARS_ULTRA, "Vertical 2K (1080x1
 
 struct Config {
     string infile;
+    bool color16 = false;  // -16
+    bool dither = false;  // -dither: ordered dither for -16
     bool color256 = false;
+    bool adaptive_palette = false;  // -256a: 256 colors fitted to each scene
+    bool rep = false;  // run-length compress cells with REP (-rep, -norep, else by terminal)
+    bool sync_output = false;  // -sync flag: write frames on the render thread, no writer thread
+    int hold = 0;  // -hold flag: cells keep glyph and color within this much change (0 = off)
     bool truecolor = false;
     bool play_audio = false;
     bool play_sound = false;  // -S flag for sound effects
@@ -91,12 +115,53 @@ struct Config {
     bool font_hint = false;  // Whether to show font size hint
     bool loop = false;  // -L flag for loop
     float speed = 1.0f;  // -S flag for speed (0.01 to 100)
+    bool has_preset = false;  // A resolution preset was given
+    bool has_custom_res = false;  // -Cr was given
+    int base_w = 0, base_h = 0;  // Preset/custom resolution limits
+    bool show_stats = false;  // -stats flag: print playback statistics on exit
+    size_t loop_cache_mb = 0;  // -Lc flag: memory budget for replaying loops (0 = off)
+    size_t rewind_mb = 32;  // -rw flag: rewind buffer for back-seeks and frame stepping (0 = off)
+    string audio_sink;  // -As flag: pulse, alsa, null or file:PATH (empty = auto)
+    string decoder;  // -dec flag: libav or pipe (empty = libav if built in, else pipe)
+    bool live = false;  // -live flag, or stdin/FIFO input: no probing, newest frame wins
+    vector<string> serve;  // -serve flag: Unix socket paths / tcp:PORT to broadcast frames on
+    bool auto_crop = false;  // -crop flag: find and cut off black bars
+    CropArea crop;  // source area being decoded: inside the black bars, zoomed in
+};
+
+// Counters reported with -stats
+struct PlaybackStats {
+    int64_t frames_shown = 0;
+    int64_t frames_dropped = 0;  // overtaken by the clock, skipped without encoding
+    int64_t frames_repeated = 0;  // identical to the frame on screen: not encoded or written
+    int64_t bytes_out = 0;  // encoded frames written to the terminal
+    int64_t status_refreshes = 0;  // display ticks without a new frame
+    double startup_ms = 0.0;  // launch to first frame on screen
+    int resizes = 0;
+    int crop_changes = 0;  // -crop: decoder restarts for a new picture area
+    int zooms = 0;  // zoom and pan keys that moved the view
+    double last_zoom_ms = 0.0;  // key to first frame of the new view
+    double max_zoom_ms = 0.0;
+    double last_resize_ms = 0.0;  // SIGWINCH to first frame at the new size
+    double max_resize_ms = 0.0;
+    int loop_replays = 0;  // loops served from the loop cache
+    int rewind_seeks = 0;  // seeks served from the rewind ring
+    int restarts = 0;  // decoder seeks (seek, loop, resize, fast-forward switch)
+    double restart_ms_sum = 0.0;  // ... to the first frame on screen
+    double max_restart_ms = 0.0;
+    int64_t av_frames = 0;  // frames shown against a playing audio clock
+    int64_t av_frames_over = 0;  // ... more than 40 ms away from it
+    double av_error_sum_ms = 0.0;
+    double av_error_max_ms = 0.0;
 };
 
 struct VideoInfo {
     double duration = 0.0;  // in seconds
     int64_t total_frames = 0;
     double fps = 25.0;
+    int width = 0, height = 0;  // first video stream
+    int video_streams = 0;
+    int audio_streams = 0;
 };
 
 pair<int,int> get_terminal_size(){
@@ -105,17 +170,69 @@ pair<int,int> get_terminal_size(){
     return {(int)w.ws_col, (int)w.ws_row};
 }
 
-static struct termios oldt;
-void set_raw(){ 
-    struct termios newt;
-    tcgetattr(STDIN_FILENO, &oldt); 
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt);
+// Frame sizes and views for the session's output size
+size_t yuv_frame_bytes(const Config& cfg) { return yuv_frame_bytes(cfg.out_w, cfg.out_h); }
+size_t compact_frame_bytes(const Config& cfg) { return compact_frame_bytes(cfg.out_w, cfg.out_h); }
+int cell_rows(const Config& cfg) { return cell_rows(cfg.out_h); }
+YuvView full_view(const unsigned char* frame, const Config& cfg) { return full_view(frame, cfg.out_w, cfg.out_h); }
+YuvView compact_view(const unsigned char* frame, const Config& cfg) { return compact_view(frame, cfg.out_w, cfg.out_h); }
+void pack_rows(unsigned char* dst, const unsigned char* src, const Config& cfg) { pack_rows(dst, src, cfg.out_w, cfg.out_h); }
+
+// What the decoder has to produce for the session's settings
+DecodeSettings decode_settings(const Config& cfg) {
+    DecodeSettings settings;
+    settings.input = cfg.infile;
+    settings.width = cfg.out_w;
+    settings.height = cfg.out_h;
+    settings.live = cfg.live;
+    settings.crop_x = cfg.crop.x;
+    settings.crop_y = cfg.crop.y;
+    settings.crop_w = cfg.crop.w;
+    settings.crop_h = cfg.crop.h;
+    string size = to_string(cfg.out_w) + ":" + to_string(cfg.out_h);
+    if (cfg.live && cfg.maintain_aspect && !cfg.force_full_terminal) {
+        // Live input isn't probed, so ffmpeg keeps the aspect and letterboxes
+        settings.filter = "scale=" + size + ":force_original_aspect_ratio=decrease,pad=" + size + ":(ow-iw)/2:(oh-ih)/2";
+    }
+    // If we have custom aspect ratio or preset, we might need to scale the video
+    else if((!cfg.custom_aspect.empty() || cfg.vertical_mode || cfg.has_preset || cfg.has_custom_res) && !cfg.force_full_terminal && cfg.maintain_aspect) {
+        // Let ffmpeg handle the scaling with the target aspect ratio
+        settings.filter = "scale=" + size + ":force_original_aspect_ratio=1";
+    }
+    return settings;
+}
+
+// -dec picks the backend; libav (when built in) falls back to the pipe if
+// it can't open the file. Live feeds always go through the pipe.
+unique_ptr<Decoder> start_decoder(const Config& cfg, double position, bool keyframes_only) {
+    return open_decoder(cfg.live ? "pipe" : cfg.decoder, decode_settings(cfg), position, keyframes_only);
+}
+
+RenderOptions render_options(const Config& cfg, shared_ptr<const Palette> palette = nullptr) {
+    RenderOptions options;
+    options.palette = palette;
+    options.rep = cfg.rep;
+    options.width = cfg.out_w;
+    options.height = cfg.out_h;
+    options.chars = cfg.chars;
+    options.color16 = cfg.color16;
+    options.dither = cfg.dither;
+    options.color256 = cfg.color256;
+    options.truecolor = cfg.truecolor;
+    return options;
 }
-void restore_term(){ 
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt); 
-    cout << "\x1b[0m\x1b[?25h" << flush; 
+
+// REP (CSI n b) is in xterm and several newer terminals, but most of them
+// still announce themselves as some xterm in TERM, so only the ones that
+// can be told apart are trusted; -rep / -norep settle it either way.
+// This is a guess about the local terminal only: XTERM_VERSION is inherited
+// by whatever runs inside the xterm (screen, tmux, ssh), and -serve clients
+// sit in terminals of their own, so a -serve player leaves REP off.
+bool terminal_has_rep() {
+    const char* term = getenv("TERM");
+    string t = term ? term : "";
+    if (getenv("XTERM_VERSION")) return true;  // set by xterm itself
+    return t == "xterm-kitty" || t.rfind("foot", 0) == 0 || t == "wezterm" || t == "contour";
 }
 
 // Function to suggest terminal font size based on PPI
@@ -133,65 +250,195 @@ string get_font_size_suggestion(int target_ppi, int term_cols, int term_rows) {
     return string(buf);
 }
 
-// Get video duration and info using ffprobe
-VideoInfo get_video_info(const string& filename) {
-    VideoInfo info;
-    
-    // Get duration
-    stringstream cmd_duration;
-    cmd_duration << "ffprobe -v error -show_entries format=duration -of default=noprint_wrappers=1:nokey=1 \""
-                 << filename << "\" 2>/dev/null";
-    
-    FILE* pipe_duration = popen(cmd_duration.str().c_str(), "r");
-    if (pipe_duration) {
-        char buf[32];
-        if (fgets(buf, sizeof(buf), pipe_duration)) {
-            info.duration = atof(buf);
+// One ffprobe run for everything we need: dimensions, frame rate and stream
+// layout of every stream plus the container duration. Sections keep their
+// [STREAM]/[FORMAT] wrappers so every key is read in its own section.
+vector<string> probe_cmd(const string& filename) {
+    return {"ffprobe", "-v", "error", "-show_entries",
+            "stream=index,codec_type,width,height,r_frame_rate:format=duration", "-i", filename};
+}
+
+double parse_rate(const string& rate) {
+    size_t slash_pos = rate.find('/');
+    if (slash_pos == string::npos) return atof(rate.c_str());
+    double num = atof(rate.substr(0, slash_pos).c_str());
+    double den = atof(rate.substr(slash_pos + 1).c_str());
+    return den > 0 ? num / den : 0.0;
+}
+
+// Parse the sectioned key=value output of probe_cmd()
+bool parse_probe(const string& text, VideoInfo& info) {
+    stringstream lines(text);
+    string line;
+    string section;  // STREAM or FORMAT
+    string stream_type;
+    bool any = false;
+    while (getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.size() > 2 && line.front() == '[') {
+            // [STREAM] ... [/STREAM], [FORMAT] ... [/FORMAT]
+            section = line[1] == '/' ? "" : line.substr(1, line.size() - 2);
+            stream_type.clear();
+            continue;
         }
-        pclose(pipe_duration);
-    }
-    
-    // Get FPS
-    stringstream cmd_fps;
-    cmd_fps << "ffprobe -v error -select_streams v:0 -show_entries stream=r_frame_rate -of default=noprint_wrappers=1:nokey=1 \""
-            << filename << "\" 2>/dev/null";
-    
-    FILE* pipe_fps = popen(cmd_fps.str().c_str(), "r");
-    if (pipe_fps) {
-        char buf[32];
-        if (fgets(buf, sizeof(buf), pipe_fps)) {
-            string fps_str = buf;
-            size_t slash_pos = fps_str.find('/');
-            if (slash_pos != string::npos) {
-                double num = atof(fps_str.substr(0, slash_pos).c_str());
-                double den = atof(fps_str.substr(slash_pos + 1).c_str());
-                if (den > 0) info.fps = num / den;
-            } else {
-                info.fps = atof(fps_str.c_str());
+        size_t eq = line.find('=');
+        if (eq == string::npos) continue;
+        string key = line.substr(0, eq);
+        string value = line.substr(eq + 1);
+        any = true;
+
+        if (section == "FORMAT") {
+            if (key == "duration") info.duration = atof(value.c_str());
+        } else if (section != "STREAM") {
+            continue;
+        } else if (key == "codec_type") {
+            stream_type = value;
+            if (value == "video") info.video_streams++;
+            else if (value == "audio") info.audio_streams++;
+        } else if (stream_type == "video" && info.video_streams == 1) {
+            if (key == "width") info.width = atoi(value.c_str());
+            else if (key == "height") info.height = atoi(value.c_str());
+            else if (key == "r_frame_rate") {
+                double fps = parse_rate(value);
+                if (fps > 0) info.fps = fps;
             }
         }
-        pclose(pipe_fps);
     }
     
     if (info.duration > 0 && info.fps > 0) {
         info.total_frames = (int64_t)(info.duration * info.fps);
     }
-    
-    return info;
+    return any;
 }
 
-// Seek to specific position in video (in seconds)
-bool seek_video(FILE*& pipe, const string& cmd_base, double position, int out_w, int out_h, int fps) {
-    // Close existing pipe
-    if (pipe) pclose(pipe);
-    
-    // Create new command with seek
-    stringstream cmd;
-    cmd << cmd_base << " -ss " << position << " ";
-    
-    // Reopen pipe at new position
-    pipe = popen(cmd.str().c_str(), "r");
-    return pipe != nullptr;
+// Bump when the cached text changes shape: older entries no longer match
+const char* PROBE_CACHE_VERSION = "probe2";
+
+// Probe results are cached on disk, keyed by path, size and mtime, so
+// relaunching the same file skips ffprobe entirely
+string probe_cache_file(const string& filename, string& key) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return "";
+
+    char real[PATH_MAX];
+    string path = realpath(filename.c_str(), real) ? real : filename;
+    key = string(PROBE_CACHE_VERSION) + "\t" + path + "\t" + to_string((long long)st.st_size) + "\t" +
+          to_string((long long)st.st_mtim.tv_sec) + "." + to_string((long long)st.st_mtim.tv_nsec);
+
+    string dir;
+    if (const char* xdg = getenv("XDG_CACHE_HOME")) dir = xdg;
+    else if (const char* home = getenv("HOME")) dir = string(home) + "/.cache";
+    else return "";
+    mkdir(dir.c_str(), 0755);
+    dir += "/mta";
+    mkdir(dir.c_str(), 0755);
+
+    // FNV-1a of the key names the entry; the key itself is stored inside
+    uint64_t hash = 1469598103934665603ULL;
+    for (unsigned char c : key) hash = (hash ^ c) * 1099511628211ULL;
+    char name[32];
+    snprintf(name, sizeof(name), "/probe-%016llx", (unsigned long long)hash);
+    return dir + name;
+}
+
+bool load_cached_probe(const string& cache_file, const string& key, VideoInfo& info) {
+    ifstream in(cache_file);
+    string stored_key;
+    if (!in || !getline(in, stored_key) || stored_key != key) return false;
+    stringstream rest;
+    rest << in.rdbuf();
+    return parse_probe(rest.str(), info);
+}
+
+void store_cached_probe(const string& cache_file, const string& key, const string& text) {
+    string tmp = cache_file + ".tmp" + to_string(getpid());
+    {
+        ofstream out(tmp);
+        if (!out) return;
+        out << key << "\n" << text;
+        if (!out) return;
+    }
+    rename(tmp.c_str(), cache_file.c_str());
+}
+
+// Blocking probe of one file, through the cache (used for playlist items
+// in the background)
+bool probe_video(const string& filename, VideoInfo& info) {
+    string key;
+    string cache_file = probe_cache_file(filename, key);
+    if (!cache_file.empty() && load_cached_probe(cache_file, key, info)) return true;
+    Child prober = spawn_child(probe_cmd(filename), false, STDERR_NULL);
+    string text = read_child_output(prober);
+    stop_child(prober);
+    if (!parse_probe(text, info)) return false;
+    if (!cache_file.empty()) store_cached_probe(cache_file, key, text);
+    return true;
+}
+
+// Terminal output per frame, and what -hold kept back
+void print_output_stats(const PlaybackStats& stats, const Stabilizer& stabilizer) {
+    int64_t drawn = stats.frames_shown - stats.frames_repeated;
+    if (drawn <= 0) return;
+    cerr << fixed << setprecision(1) << "\nOutput: " << stats.bytes_out / 1024.0 / stats.frames_shown
+         << " KB per frame shown, " << stats.bytes_out / 1024.0 / drawn << " KB per frame drawn";
+    if (stabilizer.threshold() > 0 && stabilizer.samples > 0) {
+        cerr << " (-hold " << stabilizer.threshold() << ": " << 100.0 * stabilizer.held / stabilizer.samples
+             << "% of samples held)";
+    }
+}
+
+// -crop: the first check spreads its positions over the file; later ones
+// look just ahead of playback and can only widen the area, so a dark scene
+// never crops away picture that was seen before
+const double CROP_RECHECK = 60.0;  // seconds of playback between checks
+
+// Zoom and pan: the view is a part of the source area with the same
+// aspect, so the output size stays and only the decoder restarts
+const double ZOOM_STEP = 1.25;
+const double ZOOM_MAX = 16.0;
+const double PAN_STEP = 0.1;  // share of the view per key
+
+// Items to play for the input argument: a directory plays its video files
+// in name order, an .m3u/.m3u8 playlist its entries (relative to the
+// playlist), anything else is played as a single file
+vector<string> load_playlist(const string& input) {
+    struct stat st;
+    if (stat(input.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        static const set<string> video_exts = {"mp4", "mkv", "webm", "mov", "avi", "m4v", "gif", "ts", "flv",
+                                               "wmv", "mpg", "mpeg", "ogv", "3gp"};
+        vector<string> items;
+        if (DIR* dir = opendir(input.c_str())) {
+            while (struct dirent* entry = readdir(dir)) {
+                string name = entry->d_name;
+                size_t dot = name.rfind('.');
+                if (name[0] == '.' || dot == string::npos) continue;
+                string ext = name.substr(dot + 1);
+                transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+                if (video_exts.count(ext)) items.push_back(input + "/" + name);
+            }
+            closedir(dir);
+        }
+        sort(items.begin(), items.end());
+        return items;
+    }
+
+    size_t dot = input.rfind('.');
+    string ext = dot == string::npos ? "" : input.substr(dot + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext != "m3u" && ext != "m3u8") return {input};
+
+    vector<string> items;
+    ifstream in(input);
+    size_t slash = input.rfind('/');
+    string base = slash == string::npos ? "" : input.substr(0, slash + 1);
+    string line;
+    while (getline(in, line)) {
+        while (!line.empty() && isspace((unsigned char)line.back())) line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        bool absolute = line[0] == '/' || line.find("://") != string::npos;
+        items.push_back(absolute ? line : base + line);
+    }
+    return items;
 }
 
 // Calculate seek step based on video duration
@@ -207,14 +454,6 @@ double get_seek_step(double duration) {
     return 600.0; // 10 minutes for very long videos
 }
 
-inline int lum(int r, int g, int b){ 
-    return (int)(0.2126 * r + 0.7152 * g + 0.0722 * b); 
-}
-
-int clampi(int v, int a, int b){ 
-    return v < a ? a : (v > b ? b : v); 
-}
-
 string ansi256(int r, int g, int b){
     int ir = r / 51, ig = g / 51, ib = b / 51;
     int code = 16 + 36 * ir + 6 * ig + ib;
@@ -229,26 +468,33 @@ string ansi_true(int r, int g, int b){
     return buf;
 }
 
-void play_beep() {
-    cout << "\x07" << flush;  // ASCII bell
+// During playback the bell goes through the Presenter, so it is queued
+// between frames instead of landing in the middle of one being written
+void play_beep(Presenter& screen) {
+    screen.present("\x07");  // ASCII bell
 }
 
-void play_sound_effect(const string& type) {
+// Without a screen (before and after playback) the bells go straight out
+void play_sound_effect(const string& type, Presenter* screen = nullptr) {
+    auto bell = [&](const char* bells) {
+        if (screen) screen->present(bells);
+        else cout << bells << flush;
+    };
     // Simple terminal bell variations
     if(type == "start") {
         for(int i = 0; i < 2; i++) {
-            cout << "\x07" << flush;
+            bell("\x07");
             this_thread::sleep_for(chrono::milliseconds(100));
         }
     } else if(type == "end") {
-        cout << "\x07\x07" << flush;
+        bell("\x07\x07");
     } else if(type == "error") {
         for(int i = 0; i < 3; i++) {
-            cout << "\x07" << flush;
+            bell("\x07");
             this_thread::sleep_for(chrono::milliseconds(50));
         }
     } else if(type == "seek") {
-        cout << "\x07" << flush;  // Single beep for seek
+        bell("\x07");  // Single beep for seek
     }
 }
 
@@ -289,19 +535,39 @@ pair<int, int> parse_resolution(const string& res) {
 }
 
 void usage(){
-    cout << "Usage: mta_v2 <video.mp4> [options]\n\n"
+    cout << "Usage: mta <video.mp4 | directory | playlist.m3u | - | fifo> [options]\n\n"
          << "Options:\n"
          << "  -C              Enable TrueColor (24-bit)\n"
          << "  -256            Force 256-color mode\n"
-         << "  -F<N>           Set FPS (default 25)\n"
-         << "  -A              Play audio with ffplay\n"
+         << "  -256a           256 colors fitted to each scene (reprograms the terminal palette; not with -grid)\n"
+         << "  -16             16-color mode: the shortest color codes, for slow links and serial consoles\n"
+         << "  -rep, -norep    Compress runs of identical cells with REP (default: on for terminals known to have it,\n"
+         << "                  off with -serve; screen and tmux inside an xterm look like one)\n"
+         << "  -sync           Write frames on the render thread (default: a writer thread drains\n"
+         << "                  one frame to the terminal while the next is encoded)\n"
+         << "  -hold <N>       Keep each cell's glyph and color until its brightness or color moves by more\n"
+         << "                  than N (of 255; try 8): less flicker from noise, fewer bytes per frame\n"
+         << "  -dither         Ordered dither for -16 (smoother gradients, more color changes)\n"
+         << "  -F<N>           Set display refresh rate (default 25; video keeps its own frame rate)\n"
+         << "  -A              Play audio (video follows the audio clock)\n"
+         << "  -As <sink>      Audio output: pulse, alsa, null or file:PATH (implies -A)\n"
+         << "  -dec <backend>  Decoder: libav (in-process, needs a -DMTA_LIBAV build) or pipe (ffmpeg)\n"
          << "  -S <speed>      Set playback speed (0.01 to 100, default 1.0)\n"
          << "  -L              Enable loop mode\n"
+         << "  -Lc <MB>        Keep up to MB of decoded frames to replay loops from memory\n"
+         << "  -rw <MB>        Rewind buffer for instant back-seeks and frame steps (default 32, 0 = off)\n"
          << "  -V              Vertical mode (9:16 aspect ratio)\n"
          << "  -Sc <W:H>       Custom aspect ratio (e.g., -Sc 1:1, -Sc 9:16, -Sc 4:3)\n"
          << "  -Cr <W:H>       Custom resolution (e.g., -Cr 800:600, -Cr 1920x1080)\n"
          << "  -Fc             Force full terminal size (stretch to fill entire terminal)\n"
-         << "  -font-hint      Show suggested font size for current resolution\n\n"
+         << "  -font-hint      Show suggested font size for current resolution\n"
+         << "  -stats          Print playback statistics on exit\n"
+         << "  -crop           Find black bars and fit only the picture inside them to the terminal\n"
+         << "  -grid <CxR> <files...>  Video wall: play the files (or folders) in a C by R grid\n"
+         << "  -live           Live input, newest frame wins (automatic for - and named pipes)\n"
+         << "  -serve <addr>   Also send every frame to clients on a Unix socket path or tcp:PORT (localhost)\n"
+         << "  -connect <addr> Watch a -serve player (no decoding in this terminal)\n"
+         << "  -bench          Time the frame encoder for every color mode and exit\n\n"
          << "Resolution Presets (maintain aspect ratio):\n"
          << "  Standard:\n"
          << "    -Rp           Dot preset (40x24)\n"
@@ -340,40 +606,31 @@ void usage(){
          << "Playback Controls:\n"
          << "  Space           Pause/Resume\n"
          << "  Left/Right      Seek backward/forward (step depends on video length)\n"
+         << "  ,/.             Step to previous/next frame (pauses)\n"
          << "  w/s             Increase/Decrease playback speed\n"
-         << "  L               Toggle loop mode\n"
+         << "  +/-             Zoom in/out (the decoder crops, so detail costs no more to draw)\n"
+         << "  Shift+arrows    Pan the zoomed view\n"
+         << "  0               Back to the whole picture\n"
+         << "  L               Toggle loop mode (loops the whole playlist)\n"
+         << "  n               Next playlist item\n"
          << "  b               Manual beep (if -S enabled)\n"
          << "  q/Esc           Quit\n\n"
          << "Examples:\n"
-         << "  ./mta_v2 video.mp4 -256 -F30 -A -S 1.5 -L -Rfhd\n"
-         << "  ./mta_v2 video.mp4 -V -Rvfhd -S 0.5        # Slow motion vertical\n"
-         << "  ./mta_v2 video.mp4 -Sc 1:1 -Rp -L          # Square loop\n"
-         << "  ./mta_v2 video.mp4 -R4k -font-hint -S 2.0  # 2x speed 4K\n";
+         << "  mta video.mp4 -256 -F30 -A -S 1.5 -L -Rfhd\n"
+         << "  mta video.mp4 -V -Rvfhd -S 0.5             # Slow motion vertical\n"
+         << "  mta video.mp4 -Sc 1:1 -Rp -L               # Square loop\n"
+         << "  mta clip.mp4 -L -Lc 256                    # Loop a short clip from memory\n"
+         << "  mta ~/signage/ -L -Fc                      # Play a folder of clips gaplessly, forever\n"
+         << "  mta video.mp4 -R4k -font-hint -S 2.0       # 2x speed 4K\n"
+         << "  mta -grid 2x2 a.mp4 b.mp4 c.mp4 d.mp4 -L       # Four streams on one screen\n"
+         << "  ffmpeg -re -i cam.mp4 -f nut - | mta - -stats          # Live from stdin\n"
+         << "  mta /tmp/feed -serve /tmp/mta.sock -serve tcp:7070       # Share one feed...\n"
+         << "  mta -connect /tmp/mta.sock                               # ...with other terminals\n";
     exit(0);
 }
 
 bool ffmpeg_exists(){
-    return system("which ffmpeg > /dev/null 2>&1") == 0;
-}
-
-bool ffplay_exists(){
-    return system("which ffplay > /dev/null 2>&1") == 0;
-}
-
-// Get video dimensions without processing
-pair<int, int> get_video_dimensions(const string& filename) {
-    stringstream cmd;
-    cmd << "ffprobe -v error -select_streams v:0 -show_entries stream=width,height -of csv=p=0 \""
-        << filename << "\" 2>/dev/null";
-    
-    FILE* pipe = popen(cmd.str().c_str(), "r");
-    if (!pipe) return {0, 0};
-    
-    int width = 0, height = 0;
-    fscanf(pipe, "%d,%d", &width, &height);
-    pclose(pipe);
-    
-    return {width, height};
+    return in_path("ffmpeg");
 }
 
 // Calculate output dimensions maintaining aspect ratio
@@ -451,18 +708,55 @@ pair<int, int> calculate_dimensions(int video_w, int video_h, int term_cols, int
     return {out_w, out_h};
 }
 
+// Compute output size and centering offsets for the current terminal size.
+// Called at startup and again on every SIGWINCH.
+void apply_layout(Config& cfg, int video_w, int video_h, int cols, int rows, int& x_offset, int& y_offset) {
+    if(cfg.autosize) {
+        if(cfg.maintain_aspect && video_w > 0 && video_h > 0) {
+            tie(cfg.out_w, cfg.out_h) = calculate_dimensions(video_w, video_h, cols, rows, cfg);
+        } else {
+            cfg.out_w = cols;
+            cfg.out_h = rows * 2;
+        }
+    } else if (cfg.has_preset && cfg.maintain_aspect && video_w > 0 && video_h > 0) {
+        // For presets, maintain aspect ratio within the preset's maximum dimensions
+        tie(cfg.out_w, cfg.out_h) = calculate_dimensions(video_w, video_h, cols, rows, cfg, cfg.base_w, cfg.base_h);
+    } else if (cfg.has_preset || cfg.has_custom_res) {
+        // Use preset/custom dimensions directly if not maintaining aspect
+        cfg.out_w = cfg.base_w;
+        cfg.out_h = cfg.base_h;
+    }
+
+    // Calculate centering offsets
+    x_offset = 0;
+    y_offset = 0;
+    if(!cfg.force_full_terminal && cfg.maintain_aspect && cfg.out_w < cols) {
+        x_offset = (cols - cfg.out_w) / 2;
+    }
+    
+    if(!cfg.force_full_terminal && cfg.maintain_aspect && cfg.out_h < rows * 2) {
+        y_offset = (rows * 2 - cfg.out_h) / 2;
+        // Convert to terminal rows (2 video lines per row)
+        y_offset /= 2;
+    }
+}
+
+// Above this playback speed only keyframes are decoded
+const float KEYFRAME_SPEED = 4.0f;
+
 // Draw progress bar and status
-void draw_status_bar(double current_time, double total_time, bool paused, bool loop, float speed, int cols) {
+void draw_status_bar(Presenter& screen, double current_time, double total_time, bool paused, bool loop, float speed, int cols) {
     if (total_time <= 0) return;
+    ostringstream out;
     
     // Save cursor position
-    cout << "\x1b[s";
+    out << "\x1b[s";
     
     // Move to bottom line
-    cout << "\x1b[" << (get_terminal_size().second) << ";1H";
+    out << "\x1b[" << (get_terminal_size().second) << ";1H";
     
     // Clear line
-    cout << "\x1b[2K";
+    out << "\x1b[2K";
     
     // Calculate progress
     double progress = min(1.0, max(0.0, current_time / total_time));
@@ -487,28 +781,1181 @@ void draw_status_bar(double current_time, double total_time, bool paused, bool l
     }
     
     // Draw progress bar
-    cout << "\x1b[37m["; // White color
+    out << "\x1b[37m["; // White color
     
     int pos = (int)(bar_width * progress);
     for (int i = 0; i < bar_width; i++) {
-        if (i < pos) cout << "=";
-        else if (i == pos) cout << ">";
-        else cout << "-";
+        if (i < pos) out << "=";
+        else if (i == pos) out << ">";
+        else out << "-";
     }
     
-    cout << "] " << time_buf << " ";
+    out << "] " << time_buf << " ";
     
     // Status indicators
-    if (paused) cout << "PAUSED ";
-    if (loop) cout << "LOOP ";
+    if (paused) out << "PAUSED ";
+    if (loop) out << "LOOP ";
     
-    cout << "speed: " << fixed << setprecision(2) << speed << "x";
+    out << "speed: " << fixed << setprecision(2) << speed << "x";
     
     // Reset color and restore cursor
-    cout << "\x1b[0m\x1b[u" << flush;
+    out << "\x1b[0m\x1b[u";
+    // Through the screen, so it stays in order with frames queued for the writer
+    screen.present(out.str());
+}
+
+// Encode terminal row `row` of a frame the straightforward way: settings
+// are tested and escape codes formatted cell by cell. Kept as the
+// reference the specialized kernels are checked and timed against (-bench).
+void render_row_generic(string& out, const YuvView& src, const Config& cfg, const int* ramp_of, int row) {
+    bool color = cfg.truecolor || cfg.color256;
+    static thread_local vector<unsigned char> rgb;
+    if (color && rgb.size() < (size_t)cfg.out_w * 3) rgb.resize((size_t)cfg.out_w * 3);
+    unsigned char* rs = rgb.data();
+    unsigned char* gs = rs + cfg.out_w;
+    unsigned char* bs = gs + cfg.out_w;
+
+    const unsigned char* line = src.y + row * src.y_stride;
+    if (color) {
+        size_t c_off = row * src.c_stride;
+        yuv_row_to_rgb(line, src.u + c_off, src.v + c_off, cfg.out_w, rs, gs, bs);
+    }
+    for(int x = 0; x < cfg.out_w; x++){
+        char c = cfg.chars[ramp_of[line[x]]];
+        
+        if(cfg.truecolor) out += ansi_true(rs[x], gs[x], bs[x]);
+        else if(cfg.color256) out += ansi256(rs[x], gs[x], bs[x]);
+        out += c;
+    }
+    out += "\x1b[0m";
+}
+
+// -bench: time the specialized kernels against the generic loop on a
+// synthetic frame, for every color mode with an ASCII and a UTF-8 ramp.
+// The 16-color modes have no generic version; their output size is the
+// number to compare with 256-color.
+int run_bench() {
+    Config cfg;
+    cfg.out_w = 200;
+    cfg.out_h = 100;
+    vector<unsigned char> frame(yuv_frame_bytes(cfg));
+    uint32_t seed = 12345;
+    size_t luma = (size_t)cfg.out_w * cfg.out_h;
+    for (size_t i = 0; i < frame.size(); i++) {
+        seed = seed * 1103515245u + 12345u;
+        // Gradient plus noise, so neighbouring cells differ like in video
+        int base = i < luma ? 16 + (int)(i % cfg.out_w) : 64 + (int)(i % 128);
+        frame[i] = (unsigned char)clampi(base + (int)((seed >> 16) % 32) - 16, 0, 255);
+    }
+    YuvView view = full_view(frame.data(), cfg);
+
+    cout << "Encoding a " << cfg.out_w << "x" << cell_rows(cfg) << " cell frame, ms per frame\n\n";
+    cout << "mode        ramp    generic   kernel  speedup  KB/frame  output\n";
+    const char* mode_names[5] = {"mono", "16-color", "16+dither", "256-color", "truecolor"};
+    for (int mode = 0; mode < 5; mode++) {
+        for (int ramp = 0; ramp < 2; ramp++) {
+            cfg.color16 = mode == 1 || mode == 2;
+            cfg.dither = mode == 2;
+            cfg.color256 = mode == 3;
+            cfg.truecolor = mode == 4;
+            cfg.chars = ramp ? CHARS_ULTRA : " .:-=+*#%@";
+            Renderer renderer(render_options(cfg));
+            int ramp_of[256];
+            build_ramp(ramp_of, cfg.chars.size());
+
+            string generic_out, kernel_out;
+            auto time_ms = [&](auto&& encode) {
+                int frames = 0;
+                auto start = chrono::steady_clock::now();
+                double elapsed = 0.0;
+                do {
+                    encode();
+                    frames++;
+                    elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                } while (elapsed < 300.0);
+                return elapsed / frames;
+            };
+            double kernel_ms = time_ms([&]() {
+                kernel_out.clear();
+                for (int r = 0; r < cell_rows(cfg); r++) renderer.render_row(kernel_out, view, r);
+            });
+            cout << left << setw(12) << mode_names[mode] << setw(8) << (ramp ? "utf-8" : "ascii") << right << fixed;
+            if (cfg.color16) {
+                cout << setw(7) << "-" << setprecision(3) << setw(9) << kernel_ms << setw(9) << "-" << " "
+                     << setprecision(1) << setw(9) << kernel_out.size() / 1024.0 << "  -\n";
+                continue;
+            }
+            double generic_ms = time_ms([&]() {
+                generic_out.clear();
+                for (int r = 0; r < cell_rows(cfg); r++) render_row_generic(generic_out, view, cfg, ramp_of, r);
+            });
+            // The generic loop indexes the ramp by byte, which splits UTF-8 glyphs
+            const char* check = ramp ? "fixed" : generic_out == kernel_out ? "same" : "DIFFERS";
+            cout << setprecision(3) << setw(7) << generic_ms << setw(9) << kernel_ms
+                 << setprecision(1) << setw(8) << generic_ms / kernel_ms << "x" << setw(10) << kernel_out.size() / 1024.0
+                 << "  " << check << "\n";
+        }
+    }
+
+    // What a repeated frame costs instead of an encode
+    uint64_t first = frame_hash(view, cfg.out_w, cfg.out_h);
+    int frames = 0, same = 0;
+    auto start = chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do {
+        same += frame_hash(view, cfg.out_w, cfg.out_h) == first;
+        frames++;
+        elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    } while (elapsed < 300.0);
+    cout << "\nframe hash (repeat check): " << setprecision(4) << elapsed / frames << " ms, "
+         << (same == frames ? "stable" : "UNSTABLE") << "\n";
+    return 0;
+}
+
+// Arm the frame tick timer with the given period; 0 disarms it
+void set_tick(int tick_fd, double period) {
+    struct itimerspec its = {};
+    if (period > 0) {
+        long long ns = max(1LL, (long long)(period * 1e9));
+        its.it_interval.tv_sec = ns / 1000000000LL;
+        its.it_interval.tv_nsec = ns % 1000000000LL;
+        its.it_value = its.it_interval;
+    }
+    timerfd_settime(tick_fd, 0, &its, nullptr);
+}
+
+void add_fd(int ep, int fd) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Start or stop watching an fd. Stopping removes it from the set entirely:
+// a masked fd would still report EPOLLHUP once the writer has exited.
+void watch_fd(int ep, int fd, bool enable) {
+    if (enable) add_fd(ep, fd);
+    else epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+// "tcp:PORT" is a localhost TCP port, anything else a Unix socket path
+bool socket_address(const string& addr, struct sockaddr_storage& sa, socklen_t& len) {
+    memset(&sa, 0, sizeof(sa));
+    if (addr.rfind("tcp:", 0) == 0) {
+        auto* in = (struct sockaddr_in*)&sa;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(atoi(addr.c_str() + 4));
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        len = sizeof(*in);
+        return in->sin_port != 0;
+    }
+    auto* un = (struct sockaddr_un*)&sa;
+    if (addr.empty() || addr.size() >= sizeof(un->sun_path)) return false;
+    un->sun_family = AF_UNIX;
+    memcpy(un->sun_path, addr.c_str(), addr.size());
+    len = sizeof(*un);
+    return true;
+}
+
+// A terminal watching the frames of a -serve player
+struct ServerClient {
+    deque<shared_ptr<const string>> queue;  // frames to send; the front may be partly sent
+    size_t sent = 0;  // bytes of queue.front() already sent
+    size_t pinned = 0;  // entries at the front that are never skipped (the join refresh)
+    bool want_out = false;  // waiting for EPOLLOUT
+    int64_t frames_sent = 0;
+    int64_t frames_skipped = 0;
+};
+
+// Broadcasts every encoded frame to any number of local clients. A frame
+// is encoded once and shared by all client queues; a client that can't keep
+// up loses the frames it hasn't started on, never the one mid-send, so its
+// terminal only ever sees whole frames.
+struct FrameServer {
+    vector<int> listeners;
+    vector<string> unix_paths;  // removed on exit
+    map<int, ServerClient> clients;
+    // Newest frame, a full refresh for joining clients: shared with the
+    // client queues while there are clients, a plain copy while there are none
+    shared_ptr<const string> last;
+    string latest;
+    string preamble;  // terminal state joining clients need ahead of it (-256a palette)
+    int64_t clients_served = 0;
+    int64_t frames_sent = 0;
+    int64_t frames_skipped = 0;
+};
+
+bool server_listen(FrameServer& server, const string& addr) {
+    struct sockaddr_storage sa;
+    socklen_t len;
+    if (!socket_address(addr, sa, len)) return false;
+    int fd = socket(sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    if (sa.ss_family == AF_UNIX) {
+        unlink(addr.c_str());
+    } else {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    }
+    if (bind(fd, (struct sockaddr*)&sa, len) < 0 || listen(fd, 16) < 0) {
+        close(fd);
+        return false;
+    }
+    server.listeners.push_back(fd);
+    if (sa.ss_family == AF_UNIX) server.unix_paths.push_back(addr);
+    return true;
+}
+
+void server_watch_out(int ep, int fd, ServerClient& client, bool enable) {
+    if (client.want_out == enable) return;
+    client.want_out = enable;
+    struct epoll_event ev = {};
+    ev.events = enable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void server_drop(FrameServer& server, int ep, int fd) {
+    epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    server.clients.erase(fd);
+}
+
+// Send as much of the client's queue as the socket takes without blocking
+void server_flush(FrameServer& server, int ep, int fd) {
+    ServerClient& client = server.clients[fd];
+    while (!client.queue.empty()) {
+        const string& frame = *client.queue.front();
+        ssize_t n = send(fd, frame.data() + client.sent, frame.size() - client.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                server_watch_out(ep, fd, client, true);
+                return;
+            }
+            server_drop(server, ep, fd);
+            return;
+        }
+        client.sent += n;
+        if (client.sent == frame.size()) {
+            client.queue.pop_front();
+            client.sent = 0;
+            if (client.pinned > 0) client.pinned--;
+            client.frames_sent++;
+            server.frames_sent++;
+        }
+    }
+    server_watch_out(ep, fd, client, false);
+}
+
+// A pinned frame is never skipped, whatever is queued after it
+void server_send(FrameServer& server, int ep, int fd, const shared_ptr<const string>& frame, bool pinned = false) {
+    ServerClient& client = server.clients[fd];
+    // Only the newest frame waits: skip older ones, but finish a frame
+    // that is partly out and keep the pinned ones
+    size_t keep = max(client.sent > 0 ? (size_t)1 : (size_t)0, client.pinned);
+    while (client.queue.size() > keep) {
+        client.queue.pop_back();
+        client.frames_skipped++;
+        server.frames_skipped++;
+    }
+    client.queue.push_back(frame);
+    if (pinned) client.pinned = client.queue.size();
+    server_flush(server, ep, fd);
+}
+
+void server_broadcast(FrameServer& server, int ep, const string& frame) {
+    if (server.listeners.empty()) return;
+    if (server.clients.empty()) {
+        // Nobody to share it with: keep a copy in reused memory
+        server.latest.assign(frame);
+        server.last.reset();
+        return;
+    }
+    server.last = make_shared<const string>(frame);
+    vector<int> fds;
+    for (auto& entry : server.clients) fds.push_back(entry.first);
+    for (int fd : fds) server_send(server, ep, fd, server.last);
+}
+
+bool server_owns(const FrameServer& server, int fd) {
+    return server.clients.count(fd) || find(server.listeners.begin(), server.listeners.end(), fd) != server.listeners.end();
+}
+
+void server_event(FrameServer& server, int ep, int fd, uint32_t events) {
+    if (!server.clients.count(fd)) {
+        // New clients start with a cleared screen and the current frame.
+        // The refresh also carries the palette and hides the cursor, so it
+        // is pinned: the next broadcast queues behind it instead of replacing it.
+        int cfd;
+        while ((cfd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            int on = 1;
+            setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            server.clients[cfd];
+            server.clients_served++;
+            add_fd(ep, cfd);
+            string refresh = server.preamble + "\x1b[2J\x1b[?25l";
+            refresh += server.last ? *server.last : server.latest;
+            server_send(server, ep, cfd, make_shared<const string>(move(refresh)), true);
+        }
+        return;
+    }
+    if (events & (EPOLLHUP | EPOLLERR)) {
+        server_drop(server, ep, fd);
+        return;
+    }
+    if (events & EPOLLIN) {
+        // Clients send nothing; readable means they are gone
+        char buf[256];
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            server_drop(server, ep, fd);
+            return;
+        }
+    }
+    if (events & EPOLLOUT) server_flush(server, ep, fd);
+}
+
+// Last words to every client (the -256a palette reset): queued behind what
+// it is still owed and given up to a second to go out before the close
+void server_finish(FrameServer& server, int ep, const string& text) {
+    auto last = make_shared<const string>(text);
+    vector<int> fds;
+    for (auto& entry : server.clients) fds.push_back(entry.first);
+    for (int fd : fds) server_send(server, ep, fd, last, true);
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(1);
+    vector<struct pollfd> pending;
+    while (true) {
+        pending.clear();
+        for (auto& entry : server.clients) {
+            if (!entry.second.queue.empty()) pending.push_back({entry.first, POLLOUT, 0});
+        }
+        int left = (int)chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+        if (pending.empty() || left <= 0) break;
+        if (poll(pending.data(), pending.size(), left) <= 0) break;
+        for (const struct pollfd& p : pending) {
+            if (p.revents) server_flush(server, ep, p.fd);
+        }
+    }
+}
+
+void server_close(FrameServer& server) {
+    for (auto& entry : server.clients) close(entry.first);
+    server.clients.clear();
+    for (int fd : server.listeners) close(fd);
+    server.listeners.clear();
+    for (const string& path : server.unix_paths) unlink(path.c_str());
+}
+
+void server_print_stats(const FrameServer& server) {
+    if (server.clients_served == 0 && server.listeners.empty()) return;
+    cerr << "\nServer: " << server.clients_served << " clients, " << server.frames_sent << " frames sent, "
+         << server.frames_skipped << " skipped for slow clients";
+}
+
+// -connect: thin client of a -serve player. Frames arrive fully encoded,
+// so all it does is copy the socket to the terminal.
+int run_client(const string& addr) {
+    struct sockaddr_storage sa;
+    socklen_t len;
+    int fd = -1;
+    if (socket_address(addr, sa, len)) fd = socket(sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&sa, len) < 0) {
+        cerr << "Error: can't connect to " << addr << "\n";
+        return 1;
+    }
+
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigprocmask(SIG_BLOCK, &sigs, nullptr);
+    int sig_fd = signalfd(-1, &sigs, SFD_CLOEXEC | SFD_NONBLOCK);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    add_fd(ep, STDIN_FILENO);
+    add_fd(ep, sig_fd);
+    add_fd(ep, fd);
+    Presenter screen;
+    screen.enter();
+
+    vector<char> buf(1 << 16);
+    bool running = true;
+    struct epoll_event events[4];
+    while (running && !g_stop) {
+        int n = epoll_wait(ep, events, 4, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int e = 0; e < n && running; e++) {
+            if (events[e].data.fd == fd) {
+                ssize_t got = read(fd, buf.data(), buf.size());
+                if (got > 0) screen.present(buf.data(), got);
+                else if (got == 0 || errno != EINTR) running = false;  // server gone
+            } else if (events[e].data.fd == STDIN_FILENO) {
+                unsigned char key;
+                if (read(STDIN_FILENO, &key, 1) == 1 && (key == 'q' || key == 27)) running = false;
+            } else {
+                running = false;
+            }
+        }
+    }
+
+    close(fd);
+    close(ep);
+    close(sig_fd);
+    screen.leave();
+    cout << "\n";
+    return 0;
+}
+
+// Runs a job for indices 0..n-1 on a fixed set of threads and waits for
+// all of them; the calling thread takes a share as well
+struct WorkPool {
+    vector<thread> threads;
+    mutex m;
+    condition_variable wake, done;
+    function<void(int)> job;
+    int jobs = 0, claimed = 0, finished = 0;
+    uint64_t round = 0;
+    bool quit = false;
+};
+
+// Claim and run jobs of the current round until none are left (m held)
+void pool_work(WorkPool& p, unique_lock<mutex>& lk) {
+    while (p.claimed < p.jobs) {
+        int i = p.claimed++;
+        lk.unlock();
+        p.job(i);
+        lk.lock();
+        if (++p.finished == p.jobs) p.done.notify_all();
+    }
+}
+
+void pool_start(WorkPool& p, int threads) {
+    for (int t = 0; t < threads; t++) {
+        p.threads.emplace_back([&p]() {
+            uint64_t seen = 0;
+            unique_lock<mutex> lk(p.m);
+            while (true) {
+                p.wake.wait(lk, [&]() { return p.quit || p.round != seen; });
+                if (p.quit) return;
+                seen = p.round;
+                pool_work(p, lk);
+            }
+        });
+    }
+}
+
+void pool_run(WorkPool& p, int n, function<void(int)> job) {
+    unique_lock<mutex> lk(p.m);
+    p.job = move(job);
+    p.jobs = n;
+    p.claimed = 0;
+    p.finished = 0;
+    p.round++;
+    p.wake.notify_all();
+    pool_work(p, lk);
+    p.done.wait(lk, [&]() { return p.finished == p.jobs; });
+}
+
+void pool_stop(WorkPool& p) {
+    {
+        lock_guard<mutex> lk(p.m);
+        p.quit = true;
+    }
+    p.wake.notify_all();
+    for (auto& t : p.threads) t.join();
+    p.threads.clear();
+}
+
+// Decoded frames a -grid tile keeps ahead of the clock
+const size_t GRID_QUEUE_FRAMES = 6;
+
+// One stream of a -grid video wall. Its decoder thread fills the ring ahead
+// of the clock; each display tick picks the newest frame that is due.
+struct GridTile {
+    Config cfg;  // the tile's file and output size
+    VideoInfo info;
+    int left = 0, top = 0;  // screen cell of the top-left corner
+    unique_ptr<Decoder> decoder;
+    Renderer renderer;  // for the tile's output size
+    thread worker;
+    atomic<bool> stop{false};
+    mutex m;
+    condition_variable space;  // the decoder thread waits here while the ring is full
+    RewindRing ring;
+    size_t pending = 0;  // decoded frames not shown yet: the newest ones in the ring
+    bool ended = false;  // decoder reached the end (without -L) or failed
+    double loop_offset = 0.0;  // added to decoder timestamps, grows with every loop
+    double shown_time = 0.0;  // timestamp of the frame on screen
+    string out;  // encoded frame, composited by the main thread
+    bool fresh = false;  // out holds a frame that is not on screen yet
+    bool awaiting = false;  // no frame shown since the decoder (re)started
+    int64_t frames_shown = 0;
+    int64_t frames_dropped = 0;
+};
+
+// Decoder thread of a tile. Blocks while the ring is full, so a tile never
+// decodes more than GRID_QUEUE_FRAMES ahead of the wall.
+void grid_decode_worker(GridTile* tile, const atomic<bool>* loop, bool keyframes_only) {
+    vector<unsigned char> buf(yuv_frame_bytes(tile->cfg));
+    double last_pts = -1.0, step = 1.0 / tile->info.fps;
+    while (!tile->stop) {
+        {
+            // The frame on screen stays in the ring, so never fill the last slot
+            unique_lock<mutex> lk(tile->m);
+            tile->space.wait(lk, [&]() { return tile->stop || tile->pending + 1 < tile->ring.capacity; });
+        }
+        if (tile->stop) break;
+        struct pollfd pfd = {tile->decoder->fd(), POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        double pts = 0.0;
+        int got = tile->decoder->read_frame(buf.data(), buf.size(), pts);
+        if (got > 0) {
+            pts += tile->loop_offset;
+            if (last_pts >= 0 && pts > last_pts) step = pts - last_pts;
+            last_pts = pts;
+            lock_guard<mutex> lk(tile->m);
+            ring_push(tile->ring, buf.data(), tile->cfg.out_w, tile->cfg.out_h, pts);
+            tile->pending++;
+        } else if (got < 0) {
+            // Looping continues the timestamps from the end of the previous pass
+            if (*loop && last_pts >= 0 && tile->decoder->start(decode_settings(tile->cfg), 0.0, keyframes_only)) {
+                tile->loop_offset = last_pts + step;
+                continue;
+            }
+            lock_guard<mutex> lk(tile->m);
+            tile->ended = true;
+            break;
+        }
+    }
+}
+
+// -grid CxR: several files side by side on one media clock. Every tile has
+// its own decoder thread and ring; on each display tick the due frames are
+// encoded in parallel and written out as one buffer.
+int run_grid(Config cfg, const vector<string>& files, int grid_cols, int grid_rows) {
+    auto launch_time = chrono::steady_clock::now();
+    if(!ffmpeg_exists()){ 
+        cerr << "ffmpeg not found! Install with: sudo pacman -S ffmpeg\n"; 
+        if(cfg.play_sound) play_sound_effect("error");
+        return 1; 
+    }
+    size_t cells = (size_t)grid_cols * grid_rows;
+    if (files.empty()) {
+        cerr << "Error: -grid needs at least one file\n";
+        return 1;
+    }
+    if (files.size() > cells) {
+        cerr << "Warning: " << files.size() << " files for " << cells << " tiles, playing the first " << cells << "\n";
+    }
+    if (cfg.play_audio) {
+        cerr << "Warning: -A is not supported with -grid, playing without sound\n";
+    }
+
+    // Probe all files at once; the layout needs their sizes
+    vector<future<VideoInfo>> probes;
+    for (size_t i = 0; i < min(files.size(), cells); i++) {
+        probes.push_back(async(launch::async, [file = files[i]]() {
+            VideoInfo info;
+            probe_video(file, info);
+            return info;
+        }));
+    }
+    vector<unique_ptr<GridTile>> tiles;
+    for (size_t i = 0; i < probes.size(); i++) {
+        auto tile = make_unique<GridTile>();
+        tile->cfg = cfg;
+        tile->cfg.infile = files[i];
+        // Tiles always fit their cell; presets only pick the character set
+        tile->cfg.autosize = true;
+        tile->cfg.has_preset = false;
+        tile->cfg.has_custom_res = false;
+        tile->info = probes[i].get();
+        tiles.push_back(move(tile));
+    }
+
+    int cols, rows;
+    tie(cols, rows) = get_terminal_size();
+    auto layout = [&]() {
+        int tile_cols = max(1, cols / grid_cols), tile_rows = max(1, rows / grid_rows);
+        for (size_t i = 0; i < tiles.size(); i++) {
+            GridTile& t = *tiles[i];
+            int x_offset, y_offset;
+            apply_layout(t.cfg, t.info.width, t.info.height, tile_cols, tile_rows, x_offset, y_offset);
+            t.left = (i % grid_cols) * tile_cols + x_offset;
+            t.top = (i / grid_cols) * tile_rows + y_offset;
+            t.renderer = Renderer(render_options(t.cfg));
+        }
+    };
+    layout();
+
+    cerr << "Grid: " << grid_cols << "x" << grid_rows << ", " << tiles.size() << " streams";
+    cerr << "\nTerminal: " << cols << "x" << rows;
+    cerr << "\nTile output: " << tiles[0]->cfg.out_w << "x" << tiles[0]->cfg.out_h;
+    cerr << "\n\nControls: Space=Pause, L=Loop, q=Quit\n" << flush;
+    if(cfg.play_sound) play_sound_effect("start");
+
+    atomic<bool> loop{cfg.loop};
+    bool keyframes_only = cfg.speed >= KEYFRAME_SPEED;
+
+    // Decoding for every tile starts at its own position: where its frame
+    // on screen is in the file
+    auto start_tiles = [&]() {
+        for (auto& tp : tiles) {
+            GridTile& t = *tp;
+            ring_reset(t.ring, compact_frame_bytes(t.cfg), GRID_QUEUE_FRAMES * compact_frame_bytes(t.cfg));
+            t.pending = 0;
+            t.ended = false;
+            t.stop = false;
+            t.awaiting = true;
+            t.decoder = start_decoder(t.cfg, max(0.0, t.shown_time - t.loop_offset), keyframes_only);
+            if (!t.decoder) {
+                t.ended = true;
+                continue;
+            }
+            t.worker = thread(grid_decode_worker, &t, &loop, keyframes_only);
+        }
+    };
+    auto stop_tiles = [&]() {
+        for (auto& tp : tiles) {
+            tp->stop = true;
+            tp->space.notify_all();
+        }
+        for (auto& tp : tiles) {
+            if (tp->worker.joinable()) tp->worker.join();
+            if (tp->decoder) tp->decoder->stop();
+        }
+    };
+
+    WorkPool pool;
+    int encoders = min((int)tiles.size(), max(1, (int)thread::hardware_concurrency()));
+    pool_start(pool, encoders - 1);
+
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &sigs, nullptr);
+    int sig_fd = signalfd(-1, &sigs, SFD_CLOEXEC | SFD_NONBLOCK);
+    int tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    add_fd(ep, STDIN_FILENO);
+    add_fd(ep, sig_fd);
+    add_fd(ep, tick_fd);
+
+    Presenter screen;
+    screen.enter();
+    screen.clear();
+    start_tiles();
+    auto start_time = chrono::steady_clock::now();
+
+    const double refresh_dt = 1.0 / cfg.fps;
+    MediaClock clock;
+    clock.speed = cfg.speed;
+    bool clock_started = false;  // once every tile has its first frame
+    bool paused = false;
+    bool refresh_pending = false;  // paused, but tiles restarted by a resize need a frame
+    auto media_clock = [&]() { return paused || !clock_started ? clock.base() : clock.now(); };
+
+    PlaybackStats stats;
+    string outbuf;
+    bool running = true;
+
+    // Show the newest due frame of a tile; ones it overtook are dropped
+    // without encoding. Runs on the pool, one tile per job.
+    double due = 0.0;
+    bool forced = false;
+    auto present_tile = [&](int i) {
+        GridTile& t = *tiles[i];
+        const unsigned char* frame = nullptr;
+        {
+            lock_guard<mutex> lk(t.m);
+            if (t.pending == 0) return;
+            long first = t.ring.count - t.pending;
+            if (!forced && t.ring.times[t.ring.slot(first)] > due) return;
+            long idx = first;
+            while (!forced && idx + 1 < (long)t.ring.count && t.ring.times[t.ring.slot(idx + 1)] <= due) idx++;
+            t.frames_dropped += idx - first;
+            t.pending = t.ring.count - idx - 1;
+            t.shown_time = t.ring.times[t.ring.slot(idx)];
+            frame = t.ring.frame(idx);
+        }
+        t.space.notify_one();
+        t.renderer.render_tile(t.out, compact_view(frame, t.cfg), t.left, t.top);
+        t.fresh = true;
+        t.awaiting = false;
+        t.frames_shown++;
+    };
+
+    auto tick = [&]() {
+        if (!clock_started) {
+            // Hold the clock until every tile has a frame (or 2 s passed),
+            // so slow-starting decoders don't start out late
+            bool ready = true;
+            for (auto& tp : tiles) {
+                lock_guard<mutex> lk(tp->m);
+                if (!tp->ended && tp->pending == 0) ready = false;
+            }
+            if (!ready && chrono::steady_clock::now() - start_time < chrono::seconds(2)) return;
+            clock_started = true;
+            clock.set(clock.base());
+            stats.startup_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - launch_time).count();
+        }
+        due = media_clock() + refresh_dt / 2;
+        forced = refresh_pending;
+        pool_run(pool, tiles.size(), present_tile);
+
+        // All tiles that changed go out in one write
+        outbuf.clear();
+        bool waiting = false, live = false;
+        for (auto& tp : tiles) {
+            if (tp->fresh) {
+                outbuf += tp->out;
+                tp->fresh = false;
+            }
+            lock_guard<mutex> lk(tp->m);
+            if (!tp->ended || tp->pending > 0) live = true;
+            if (!tp->ended && tp->awaiting) waiting = true;
+        }
+        if (!outbuf.empty()) screen.present(outbuf);
+        if (!live && !loop) running = false;
+        if (refresh_pending && !waiting) {
+            refresh_pending = false;
+            if (paused) set_tick(tick_fd, 0);
+        }
+    };
+
+    auto handle_resize = [&]() {
+        int new_cols, new_rows;
+        tie(new_cols, new_rows) = get_terminal_size();
+        if (new_cols == cols && new_rows == rows) return;
+        cols = new_cols;
+        rows = new_rows;
+        stats.resizes++;
+        // Every tile restarts at its frame on screen with the new size
+        stop_tiles();
+        layout();
+        screen.clear();
+        start_tiles();
+        refresh_pending = true;
+        set_tick(tick_fd, refresh_dt);
+    };
+
+    set_tick(tick_fd, refresh_dt);
+    struct epoll_event events[8];
+    while(running && !g_stop){
+        int n = epoll_wait(ep, events, 8, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int e = 0; e < n && running; e++) {
+            int fd = events[e].data.fd;
+            if (fd == sig_fd) {
+                struct signalfd_siginfo si;
+                while (read(sig_fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+                    if (si.ssi_signo == SIGWINCH) handle_resize();
+                    else running = false;
+                }
+            }
+            else if (fd == STDIN_FILENO) {
+                unsigned char keys[64];
+                ssize_t got = read(STDIN_FILENO, keys, sizeof(keys));
+                for (ssize_t i = 0; i < got; i++) {
+                    unsigned char c = keys[i];
+                    if (c == 0x1b && i + 2 < got && keys[i+1] == '[') { i += 2; continue; }  // arrows: no seeking in a grid
+                    if (c == 'q' || c == 27) running = false;
+                    else if (c == ' ') {
+                        if (!paused) {
+                            clock.set(media_clock());
+                            paused = true;
+                            set_tick(tick_fd, 0);
+                        } else {
+                            paused = false;
+                            clock.set(clock.base());
+                            set_tick(tick_fd, refresh_dt);
+                        }
+                        if(cfg.play_sound) play_beep(screen);
+                    }
+                    else if (c == 'L' || c == 'l') {
+                        loop = !loop;
+                        if(cfg.play_sound) play_beep(screen);
+                    }
+                }
+            }
+            else if (fd == tick_fd) {
+                uint64_t expirations;
+                if (read(tick_fd, &expirations, sizeof(expirations)) > 0) tick();
+            }
+        }
+    }
+
+    double played = media_clock() / cfg.speed;  // wall seconds of playback
+    stop_tiles();
+    pool_stop(pool);
+    close(ep);
+    close(tick_fd);
+    close(sig_fd);
+    screen.leave();
+
+    if(cfg.play_sound) play_sound_effect("end");
+
+    if(cfg.show_stats) {
+        cerr << fixed << setprecision(1) << "\nStartup: " << stats.startup_ms << " ms to first frame on every tile ("
+             << (tiles[0]->decoder ? tiles[0]->decoder->name() : "no") << " decoder, encoder threads: "
+             << encoders << ")";
+        for (size_t i = 0; i < tiles.size(); i++) {
+            GridTile& t = *tiles[i];
+            stats.frames_shown += t.frames_shown;
+            cerr << "\nTile " << i + 1 << " " << t.cfg.infile << ": " << t.frames_shown << " shown, "
+                 << t.frames_dropped << " dropped, " << (played > 0 ? t.frames_shown / played : 0.0) << " fps";
+        }
+        struct rusage self_usage, child_usage;
+        getrusage(RUSAGE_SELF, &self_usage);
+        getrusage(RUSAGE_CHILDREN, &child_usage);
+        auto cpu_ms = [](const struct rusage& u) {
+            return (u.ru_utime.tv_sec + u.ru_stime.tv_sec) * 1000.0 + (u.ru_utime.tv_usec + u.ru_stime.tv_usec) / 1000.0;
+        };
+        if (stats.frames_shown > 0) {
+            cerr << "\nCPU: " << (cpu_ms(self_usage) + cpu_ms(child_usage)) / stats.frames_shown
+                 << " ms per frame shown (player and decoders)";
+        }
+        if (stats.resizes > 0) cerr << "\nResizes: " << stats.resizes;
+        cerr << "\n";
+    }
+
+    cout << "\n";
+    return 0;
+}
+
+// -live: the decoder pipe is drained on a thread of its own, whatever the
+// terminal is doing. Only the newest complete frame is kept, so a slow
+// terminal or network drops frames instead of backing the feed up into
+// ffmpeg and the FIFO. wake_fd (an eventfd) tells the event loop a frame is in.
+struct LiveReader {
+    thread worker;
+    atomic<bool> stop{false};
+    int wake_fd = -1;
+    mutex m;
+    vector<unsigned char> latest;  // newest complete frame
+    double latest_pts = 0.0;
+    int64_t fresh = 0;  // frames decoded since the main thread last took one
+    bool ended = false;  // the feed ended or the decoder failed
+};
+
+void live_reader_worker(LiveReader* reader, Decoder* decoder, size_t frame_bytes) {
+    vector<unsigned char> buf(frame_bytes);  // may hold a partly read frame
+    while (!reader->stop) {
+        struct pollfd pfd = {decoder->fd(), POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0) continue;
+        double pts = 0.0;
+        int got;
+        int64_t decoded = 0;
+        while ((got = decoder->read_frame(buf.data(), buf.size(), pts)) > 0) {
+            lock_guard<mutex> lk(reader->m);
+            swap(buf, reader->latest);
+            reader->latest_pts = pts;
+            reader->fresh++;
+            decoded++;
+        }
+        if (got < 0) {
+            lock_guard<mutex> lk(reader->m);
+            reader->ended = true;
+        }
+        if (decoded > 0 || got < 0) {
+            uint64_t one = 1;
+            ssize_t ignored = write(reader->wake_fd, &one, sizeof(one));
+            (void)ignored;
+        }
+        if (got < 0) break;
+    }
+}
+
+void live_reader_start(LiveReader& reader, Decoder* decoder, size_t frame_bytes) {
+    reader.stop = false;
+    reader.latest.assign(frame_bytes, 0);
+    reader.fresh = 0;
+    reader.ended = false;
+    reader.worker = thread(live_reader_worker, &reader, decoder, frame_bytes);
+}
+
+void live_reader_stop(LiveReader& reader) {
+    reader.stop = true;
+    if (reader.worker.joinable()) reader.worker.join();
+}
+
+// Live input (-live, stdin or a FIFO): nothing is probed and nothing is
+// paced. Frames are shown as soon as they are decoded; when rendering
+// falls behind, everything already waiting in the pipe is skipped and only
+// the newest frame is encoded, so delay never builds up.
+int run_live(Config cfg) {
+    auto launch_time = chrono::steady_clock::now();
+    if(!ffmpeg_exists()){ 
+        cerr << "ffmpeg not found! Install with: sudo pacman -S ffmpeg\n"; 
+        if(cfg.play_sound) play_sound_effect("error");
+        return 1; 
+    }
+    if (cfg.play_audio) cerr << "Warning: -A is not supported with live input, playing without sound\n";
+    if (cfg.decoder == "libav") cerr << "Warning: live input always uses the ffmpeg pipe decoder\n";
+
+    // Video on stdin: ffmpeg reads a copy of it, keys come from the terminal.
+    // A FIFO is held open by the player as well, so the writer doesn't get
+    // EPIPE while the decoder restarts after a resize.
+    string source = cfg.infile;
+    int feed_fd = -1;
+    struct stat st;
+    if (cfg.infile == "-") {
+        feed_fd = dup(STDIN_FILENO);
+        int tty = open("/dev/tty", O_RDONLY | O_CLOEXEC);
+        if (tty < 0) {
+            cerr << "Error: video on stdin needs a terminal (/dev/tty) for the keys\n";
+            return 1;
+        }
+        dup2(tty, STDIN_FILENO);
+        close(tty);
+        source = "stdin";
+    } else if (stat(cfg.infile.c_str(), &st) == 0 && S_ISFIFO(st.st_mode)) {
+        cerr << "Waiting for a writer on " << cfg.infile << "...\n" << flush;
+        feed_fd = open(cfg.infile.c_str(), O_RDONLY);
+    }
+    if (feed_fd >= 0) cfg.infile = "pipe:" + to_string(feed_fd);  // inherited by ffmpeg
+
+    int cols, rows;
+    tie(cols, rows) = get_terminal_size();
+    int x_offset = 0, y_offset = 0;
+    apply_layout(cfg, 0, 0, cols, rows, x_offset, y_offset);
+
+    cerr << "Live: " << source;
+    cerr << "\nTerminal: " << cols << "x" << rows;
+    cerr << "\nOutput: " << cfg.out_w << "x" << cfg.out_h;
+    cerr << "\n\nControls: Space=Pause, q=Quit\n" << flush;
+    if(cfg.play_sound) play_sound_effect("start");
+
+    unique_ptr<Decoder> decoder = start_decoder(cfg, 0.0, false);
+    if (!decoder) {
+        cerr << "Error: failed to start the decoder!\n";
+        if(cfg.play_sound) play_sound_effect("error");
+        return 1;
+    }
+
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &sigs, nullptr);
+    int sig_fd = signalfd(-1, &sigs, SFD_CLOEXEC | SFD_NONBLOCK);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    add_fd(ep, STDIN_FILENO);
+    add_fd(ep, sig_fd);
+    LiveReader reader;
+    reader.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    add_fd(ep, reader.wake_fd);
+
+    FrameServer server;
+    for (const string& addr : cfg.serve) {
+        if (!server_listen(server, addr)) {
+            cerr << "Error: can't listen on " << addr << "\n";
+            decoder->stop();
+            server_close(server);
+            if (feed_fd >= 0) close(feed_fd);
+            close(reader.wake_fd);
+            close(ep);
+            close(sig_fd);
+            return 1;
+        }
+        add_fd(ep, server.listeners.back());
+    }
+
+    Presenter screen;
+    screen.enter();
+    // Encoding the next frame overlaps writing this one
+    if (!cfg.sync_output) screen.start_writer();
+    screen.clear();
+
+    size_t frame_bytes = yuv_frame_bytes(cfg);
+    vector<unsigned char> frame(frame_bytes);
+    live_reader_start(reader, decoder.get(), frame_bytes);
+    string outbuf;
+    Renderer renderer(render_options(cfg));
+    ScenePalette scene;  // -256a
+    if (cfg.adaptive_palette) scene_palette_start(scene);
+    PlaybackStats stats;
+    bool paused = false;
+    bool running = true;
+    // Hash of the frame on screen: a feed that repeats itself (a slide, a
+    // still camera) is not encoded again
+    uint64_t screen_hash = 0;
+    bool screen_valid = false;
+    Stabilizer stabilizer(cfg.hold);  // -hold
+
+    // Latency is the frame's display time against its timestamp. Feeds
+    // stamped with the wall clock (setpts=RTCTIME) give glass-to-glass
+    // latency directly; otherwise it is measured against the fastest frame
+    // seen, i.e. the delay added on top of the best case.
+    int64_t lat_frames = 0;
+    double lat_sum = 0.0, lat_max = -1e300, lat_min = 1e300;  // display - pts, seconds
+    bool lat_wallclock = false;
+    auto record_latency = [&](double pts) {
+        double now = chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count();
+        if (lat_frames == 0) lat_wallclock = fabs(now - pts) < 3600.0;
+        lat_frames++;
+        lat_sum += now - pts;
+        lat_max = max(lat_max, now - pts);
+        lat_min = min(lat_min, now - pts);
+    };
+
+    auto handle_resize = [&]() {
+        int new_cols, new_rows;
+        tie(new_cols, new_rows) = get_terminal_size();
+        if (new_cols == cols && new_rows == rows) return;
+        cols = new_cols;
+        rows = new_rows;
+        apply_layout(cfg, 0, 0, cols, rows, x_offset, y_offset);
+        screen.clear();
+        screen_valid = false;
+        stats.resizes++;
+        // The new decoder picks the feed up at its next keyframe
+        live_reader_stop(reader);
+        frame_bytes = yuv_frame_bytes(cfg);
+        renderer = Renderer(render_options(cfg, scene.current));
+        frame.resize(frame_bytes);
+        if (!decoder->start(decode_settings(cfg), 0.0, false)) { running = false; return; }
+        live_reader_start(reader, decoder.get(), frame_bytes);
+        stats.restarts++;
+    };
+
+    struct epoll_event events[8];
+    while(running && !g_stop){
+        int n = epoll_wait(ep, events, 8, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int e = 0; e < n && running; e++) {
+            int fd = events[e].data.fd;
+            if (fd == sig_fd) {
+                struct signalfd_siginfo si;
+                while (read(sig_fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+                    if (si.ssi_signo == SIGWINCH) handle_resize();
+                    else running = false;
+                }
+            }
+            else if (fd == STDIN_FILENO) {
+                unsigned char keys[64];
+                ssize_t got = read(STDIN_FILENO, keys, sizeof(keys));
+                for (ssize_t i = 0; i < got; i++) {
+                    if (keys[i] == 0x1b && i + 2 < got && keys[i+1] == '[') { i += 2; continue; }  // no seeking live
+                    if (keys[i] == 'q' || keys[i] == 27) running = false;
+                    else if (keys[i] == ' ') {
+                        paused = !paused;
+                        if(cfg.play_sound) play_beep(screen);
+                    }
+                }
+            }
+            else if (server_owns(server, fd)) {
+                server_event(server, ep, fd, events[e].events);
+            }
+            else if (fd == reader.wake_fd) {
+                // Take the newest frame; the ones it overtook are dropped
+                // without encoding
+                uint64_t wakes;
+                ssize_t ignored = read(reader.wake_fd, &wakes, sizeof(wakes));
+                (void)ignored;
+                int64_t decoded;
+                double frame_pts;
+                bool ended;
+                {
+                    lock_guard<mutex> lk(reader.m);
+                    decoded = reader.fresh;
+                    reader.fresh = 0;
+                    if (decoded > 0) swap(frame, reader.latest);
+                    frame_pts = reader.latest_pts;
+                    ended = reader.ended;
+                }
+                if (decoded > 0) {
+                    if (paused) {
+                        stats.frames_dropped += decoded;
+                    } else {
+                        stats.frames_dropped += decoded - 1;
+                        YuvView view = full_view(frame.data(), cfg);
+                        if (cfg.hold > 0) view = stabilizer.apply(view, cfg.out_w, cfg.out_h);
+                        bool new_palette = cfg.adaptive_palette && scene_palette_update(scene, view, cfg.out_w, cfg.out_h);
+                        if (new_palette) renderer = Renderer(render_options(cfg, scene.current));
+                        uint64_t hash = frame_hash(view, cfg.out_w, cfg.out_h);
+                        bool update = screen_valid && !new_palette;
+                        if (update && hash == screen_hash) {
+                            stats.frames_repeated++;
+                        } else {
+                            // -hold: only the rows where something moved
+                            if (update && cfg.hold > 0 && cfg.serve.empty()) {
+                                renderer.render_rows(outbuf, view, x_offset, y_offset, stabilizer.changed_rows());
+                            } else {
+                                renderer.render(outbuf, view, x_offset, y_offset);
+                            }
+                            if (new_palette) {
+                                server.preamble = palette_osc(*scene.current);
+                                outbuf.insert(0, server.preamble);
+                            }
+                            server_broadcast(server, ep, outbuf);
+                            stats.bytes_out += outbuf.size();
+                            screen.submit(outbuf);
+                            screen_hash = hash;
+                            screen_valid = true;
+                        }
+                        if (stats.frames_shown++ == 0) {
+                            stats.startup_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - launch_time).count();
+                        }
+                        record_latency(frame_pts);
+                    }
+                }
+                if (ended) running = false;  // the feed ended
+            }
+        }
+    }
+
+    live_reader_stop(reader);
+    decoder->stop();
+    if (cfg.adaptive_palette) server_finish(server, ep, PALETTE_RESET);
+    server_close(server);
+    if (feed_fd >= 0) close(feed_fd);
+    close(reader.wake_fd);
+    close(ep);
+    close(sig_fd);
+    if (cfg.adaptive_palette) {
+        scene_palette_stop(scene);
+        screen.present(PALETTE_RESET);
+    }
+    screen.leave();
+
+    if(cfg.play_sound) play_sound_effect("end");
+
+    if(cfg.show_stats) {
+        cerr << "\nFrames shown: " << stats.frames_shown << ", skipped for a newer frame: " << stats.frames_dropped
+             << ", repeats not redrawn: " << stats.frames_repeated;
+        print_output_stats(stats, stabilizer);
+        cerr << fixed << setprecision(1) << "\nStartup: " << stats.startup_ms << " ms to first frame";
+        if (lat_frames > 0) {
+            double base = lat_wallclock ? 0.0 : lat_min;
+            cerr << "\nLatency: mean " << (lat_sum / lat_frames - base) * 1000.0 << " ms, max "
+                 << (lat_max - base) * 1000.0 << " ms "
+                 << (lat_wallclock ? "(glass to glass, wall-clock timestamps)" : "(added delay over the fastest frame)");
+        }
+        if (stats.resizes > 0) cerr << "\nResizes: " << stats.resizes << " (decoder restarts: " << stats.restarts << ")";
+        if (cfg.adaptive_palette) cerr << "\nScene palettes: " << scene.changes;
+        server_print_stats(server);
+        cerr << "\n";
+    }
+
+    cout << "\n";
+    return 0;
 }
 
 int main(int argc, char** argv){
+    auto launch_time = chrono::steady_clock::now();
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
 
@@ -518,13 +1965,20 @@ int main(int argc, char** argv){
 
     Config cfg;
     cfg.infile = argv[1];
+    // "mta -grid 2x2 a.mp4 ..." or "mta -connect sock" start with a flag
+    // instead of a file ("-" alone is video on stdin)
+    int first_arg = 2;
+    if (argv[1][0] == '-' && argv[1][1] != '\0') {
+        cfg.infile.clear();
+        first_arg = 1;
+    }
     
     // First pass: check for preset flags to set base dimensions
     bool has_preset = false;
     bool has_custom_res = false;
     int preset_base_w = 0, preset_base_h = 0;
     
-    for(int i = 2; i < argc; i++){
+    for(int i = first_arg; i < argc; i++){
         string s = argv[i];
         
         // Standard presets
@@ -751,15 +2205,55 @@ int main(int argc, char** argv){
     }
     
     // Second pass: process other flags
-    for(int i = 2; i < argc; i++){
+    int grid_cols = 0, grid_rows = 0;
+    int rep_flag = -1;  // -rep / -norep, -1 = by terminal
+    vector<string> grid_inputs;
+    if (!cfg.infile.empty()) grid_inputs.push_back(cfg.infile);
+    for(int i = first_arg; i < argc; i++){
         string s = argv[i];
         if(s == "-C") cfg.truecolor = true;
         else if(s == "-256") cfg.color256 = true;
+        else if(s == "-256a") cfg.color256 = cfg.adaptive_palette = true;
+        else if(s == "-16") cfg.color16 = true;
+        else if(s == "-rep") rep_flag = 1;
+        else if(s == "-norep") rep_flag = 0;
+        else if(s == "-dither") cfg.dither = true;
         else if(s == "-A") cfg.play_audio = true;
+        else if(s == "-dec" && i+1 < argc) {
+            cfg.decoder = argv[++i];
+        }
+        else if(s == "-As" && i+1 < argc) {
+            cfg.play_audio = true;
+            cfg.audio_sink = argv[++i];
+        }
         else if(s == "-L") cfg.loop = true;
+        else if(s == "-live") cfg.live = true;
+        else if(s == "-serve" && i+1 < argc) cfg.serve.push_back(argv[++i]);
+        else if(s == "-connect" && i+1 < argc) return run_client(argv[++i]);
+        else if(s == "-bench") return run_bench();
+        else if(s == "-grid" && i+1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &grid_cols, &grid_rows) != 2 || grid_cols < 1 || grid_rows < 1) {
+                cerr << "Error: invalid grid " << argv[i] << " (use CxR, e.g. -grid 2x2)\n";
+                return 1;
+            }
+            // The files follow the grid size
+            while (i+1 < argc && argv[i+1][0] != '-') grid_inputs.push_back(argv[++i]);
+        }
+        else if(s == "-Lc" && i+1 < argc) {
+            cfg.loop_cache_mb = max(0, atoi(argv[++i]));
+        }
+        else if(s == "-rw" && i+1 < argc) {
+            cfg.rewind_mb = max(0, atoi(argv[++i]));
+        }
         else if(s == "-V") cfg.vertical_mode = true;
         else if(s == "-Fc") cfg.force_full_terminal = true;
         else if(s == "-font-hint") cfg.font_hint = true;
+        else if(s == "-stats") cfg.show_stats = true;
+        else if(s == "-crop") cfg.auto_crop = true;
+        else if(s == "-sync") cfg.sync_output = true;
+        else if(s == "-hold" && i+1 < argc) {
+            cfg.hold = clamp(atoi(argv[++i]), 0, 255);
+        }
         else if(s == "-stretch") cfg.maintain_aspect = false;
         else if(s == "-S" && i+1 < argc) {
             float speed_val = atof(argv[++i]);
@@ -807,6 +2301,58 @@ int main(int argc, char** argv){
         }
         else if(s == "-h" || s == "--help") usage();
     }
+    cfg.rep = rep_flag >= 0 ? rep_flag == 1 : cfg.serve.empty() && terminal_has_rep();
+    if (cfg.decoder == "libav" && !has_libav()) {
+        cerr << "Error: -dec libav needs a build with libav (make LIBAV=1)\n";
+        return 1;
+    }
+
+    if (grid_cols > 0) {
+        // Folders and playlists fill the wall with their items
+        vector<string> files;
+        for (const string& input : grid_inputs) {
+            for (string& f : load_playlist(input)) files.push_back(move(f));
+        }
+        return run_grid(cfg, files, grid_cols, grid_rows);
+    }
+
+    // Video from stdin or a named pipe (or a stream URL with -live)
+    struct stat in_st;
+    if (cfg.infile == "-" || (stat(cfg.infile.c_str(), &in_st) == 0 && S_ISFIFO(in_st.st_mode))) cfg.live = true;
+    if (cfg.live) {
+        cfg.has_preset = has_preset;
+        cfg.has_custom_res = has_custom_res;
+        cfg.base_w = preset_base_w;
+        cfg.base_h = preset_base_h;
+        return run_live(cfg);
+    }
+
+    // A directory or .m3u playlist plays its items one after another
+    vector<string> playlist = load_playlist(cfg.infile);
+    if (playlist.empty()) {
+        cerr << "Error: nothing to play in " << cfg.infile << "\n";
+        return 1;
+    }
+    cfg.infile = playlist[0];
+
+    // Start probing right away (or use the cached result). If the layout
+    // doesn't depend on the source size, the probe finishes in the background
+    // while the decoder is already running.
+    VideoInfo video_info;
+    string probe_key;
+    string probe_file = probe_cache_file(cfg.infile, probe_key);
+    bool probe_done = !probe_file.empty() && load_cached_probe(probe_file, probe_key, video_info);
+    Child prober;
+    string probe_out;
+    if (!probe_done) prober = spawn_child(probe_cmd(cfg.infile), false, STDERR_NULL);
+
+    auto finish_probe = [&]() {
+        if (parse_probe(probe_out, video_info) && !probe_file.empty()) {
+            store_cached_probe(probe_file, probe_key, probe_out);
+        }
+        stop_child(prober);
+        probe_done = true;
+    };
 
     if(!ffmpeg_exists()){ 
         cerr << "ffmpeg not found! Install with: sudo pacman -S ffmpeg\n"; 
@@ -814,58 +2360,57 @@ int main(int argc, char** argv){
         return 1; 
     }
     
-    if(cfg.play_audio && !ffplay_exists()){ 
-        cerr << "ffplay not found! Install with: sudo pacman -S ffmpeg\n"; 
-        if(cfg.play_sound) play_sound_effect("error");
-        return 1; 
+    AudioPlayer audio;
+    if(cfg.play_audio){
+        audio.sink = make_audio_sink(cfg.audio_sink);
+        if(!audio.sink || !audio.sink->open()){
+            if(cfg.audio_sink == "pulse" && !in_path("pacat")) {
+                cerr << "Audio output 'pulse' needs pacat (pulseaudio-utils or pipewire-pulse)\n";
+            } else if(cfg.audio_sink == "alsa" && !in_path("aplay")) {
+                cerr << "Audio output 'alsa' needs aplay (alsa-utils)\n";
+            } else {
+                cerr << "Audio output '" << cfg.audio_sink << "' is not available (use pulse, alsa, null or file:PATH)\n";
+            }
+            if(cfg.play_sound) play_sound_effect("error");
+            return 1;
+        }
+        if(cfg.audio_sink.empty() && !in_path("pacat") && !in_path("aplay")){
+            cerr << "Warning: neither pacat nor aplay found, audio is muted\n";
+        }
     }
 
     // Get terminal size
-    auto [cols, rows] = get_terminal_size();
+    int cols, rows;
+    tie(cols, rows) = get_terminal_size();
     
     if(cfg.play_sound) play_sound_effect("start");
     
-    // Get video dimensions and info
-    auto [video_w, video_h] = get_video_dimensions(cfg.infile);
-    VideoInfo video_info = get_video_info(cfg.infile);
+    // When the output size depends on the source size, decoding starts at
+    // the terminal-fit size anyway and is laid out again once the probe is in
+    bool layout_needs_probe = cfg.maintain_aspect && !cfg.force_full_terminal && (cfg.autosize || has_preset);
+    int video_w = video_info.width, video_h = video_info.height;
     
-    // Calculate output dimensions
-    if(cfg.autosize) {
-        if(cfg.maintain_aspect && video_w > 0 && video_h > 0) {
-            tie(cfg.out_w, cfg.out_h) = calculate_dimensions(video_w, video_h, cols, rows, cfg);
-        } else {
-            cfg.out_w = cols;
-            cfg.out_h = rows * 2;
-        }
-    } else if (has_preset && cfg.maintain_aspect && video_w > 0 && video_h > 0) {
-        // For presets, maintain aspect ratio within the preset's maximum dimensions
-        tie(cfg.out_w, cfg.out_h) = calculate_dimensions(video_w, video_h, cols, rows, cfg, preset_base_w, preset_base_h);
-    } else if (has_preset || has_custom_res) {
-        // Use preset/custom dimensions directly if not maintaining aspect
-        cfg.out_w = preset_base_w;
-        cfg.out_h = preset_base_h;
-    }
+    cfg.has_preset = has_preset;
+    cfg.has_custom_res = has_custom_res;
+    cfg.base_w = preset_base_w;
+    cfg.base_h = preset_base_h;
 
-    // Calculate centering offsets
+    // Calculate output dimensions and centering offsets
     int x_offset = 0, y_offset = 0;
-    if(!cfg.force_full_terminal && cfg.maintain_aspect && cfg.out_w < cols) {
-        x_offset = (cols - cfg.out_w) / 2;
-    }
-    
-    if(!cfg.force_full_terminal && cfg.maintain_aspect && cfg.out_h < rows * 2) {
-        y_offset = (rows * 2 - cfg.out_h) / 2;
-        // Convert to terminal rows (2 video lines per row)
-        y_offset /= 2;
-    }
+    apply_layout(cfg, video_w, video_h, cols, rows, x_offset, y_offset);
 
     // Display configuration info
-    if(video_w > 0 && video_h > 0) {
-        cerr << "Video: " << video_w << "x" << video_h;
+    if((video_w > 0 && video_h > 0) || !probe_done) {
+        if(probe_done) cerr << "Video: " << video_w << "x" << video_h;
+        else cerr << "Video: probing in background";
         if(!cfg.custom_aspect.empty()) {
             cerr << ", Custom aspect: " << cfg.custom_aspect;
         } else if(cfg.vertical_mode) {
             cerr << ", Vertical mode (9:16)";
         }
+        if(playlist.size() > 1) {
+            cerr << "\nPlaylist: " << playlist.size() << " items";
+        }
         if(!cfg.preset_name.empty()) {
             cerr << "\nPreset: " << cfg.preset_name;
         }
@@ -894,221 +2439,876 @@ int main(int argc, char** argv){
             cerr << "\n" << get_font_size_suggestion(cfg.target_ppi, cols, rows);
         }
         
-        cerr << "\n\nControls: Space=Pause, L=Loop, w/s=Speed, ←/→=Seek, b=Beep, q=Quit\n" << flush;
-    }
-
-    // start audio async if requested
-    thread audio_thr;
-    if(cfg.play_audio){
-        string cmd_audio = "ffplay -nodisp -autoexit -loglevel quiet \"" + cfg.infile + "\" &";
-        system(cmd_audio.c_str());
+        cerr << "\n\nControls: Space=Pause, L=Loop, w/s=Speed, ←/→=Seek, ,/.=Step, +/-=Zoom, Shift+arrows=Pan, "
+             << (playlist.size() > 1 ? "n=Next, " : "") << "b=Beep, q=Quit\n" << flush;
     }
 
-    // prepare ffmpeg command base (without seek)
-    stringstream cmd_base;
-    cmd_base << "ffmpeg -i \"" << cfg.infile << "\" -loglevel quiet -an "
-        << "-f rawvideo -pix_fmt rgb24 -r " << cfg.fps;
-    
-    // If we have custom aspect ratio or preset, we might need to scale the video
-    if((!cfg.custom_aspect.empty() || cfg.vertical_mode || has_preset || has_custom_res) && !cfg.force_full_terminal && cfg.maintain_aspect) {
-        // Let ffmpeg handle the scaling with the target aspect ratio
-        cmd_base << " -vf \"scale=" << cfg.out_w << ":" << cfg.out_h << ":force_original_aspect_ratio=1\"";
-    }
-    
-    cmd_base << " -s " << cfg.out_w << "x" << cfg.out_h << " pipe:1";
-    
-    string base_cmd_str = cmd_base.str();
-    FILE* pipe = popen(base_cmd_str.c_str(), "r");
-    if(!pipe){ 
-        cerr << "Error: failed to start ffmpeg!\n"; 
+    // Start in keyframe mode right away if -S asks for fast-forward
+    bool keyframe_mode = cfg.speed >= KEYFRAME_SPEED;
+    unique_ptr<Decoder> decoder = start_decoder(cfg, 0.0, keyframe_mode);
+    if(!decoder){ 
+        cerr << "Error: failed to start the decoder!\n"; 
         if(cfg.play_sound) play_sound_effect("error");
         return 1; 
     }
 
-    set_raw();
-    cout << "\x1b[2J\x1b[?25l" << flush;
+    // Everything the loop waits on is an fd: keys, decoder output, frame ticks
+    // and signals. Nothing polls, so a paused player sleeps until an event.
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &sigs, nullptr);
+    int sig_fd = signalfd(-1, &sigs, SFD_CLOEXEC | SFD_NONBLOCK);
+    int tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    add_fd(ep, STDIN_FILENO);
+    add_fd(ep, sig_fd);
+    add_fd(ep, tick_fd);
+    add_fd(ep, decoder->fd());
+    if (prober.fd >= 0) add_fd(ep, prober.fd);
 
-    size_t frame_bytes = (size_t)cfg.out_w * cfg.out_h * 3;
-    vector<unsigned char> frame(frame_bytes);
-    const double base_frame_dt = 1.0 / cfg.fps;
-    int ramp_len = cfg.chars.size();
+    // -serve: every frame encoded here also goes to the connected clients
+    FrameServer server;
+    for (const string& addr : cfg.serve) {
+        if (!server_listen(server, addr)) {
+            cerr << "Error: can't listen on " << addr << "\n";
+            decoder->stop();
+            stop_child(prober);
+            server_close(server);
+            close(ep);
+            close(tick_fd);
+            close(sig_fd);
+            return 1;
+        }
+        add_fd(ep, server.listeners.back());
+    }
+
+    Presenter screen;
+    screen.enter();
+    // Encoding the next frame overlaps writing this one
+    if (!cfg.sync_output) screen.start_writer();
+    screen.clear();
+
+    size_t frame_bytes = yuv_frame_bytes(cfg);
+    vector<unsigned char> frame(frame_bytes);       // frame on screen
+    vector<unsigned char> next_frame(frame_bytes);  // frame being read from the decoder
+    bool next_ready = false;
+    double next_pts = 0.0;  // source time of next_frame
+    double decoded_pts = -1.0;  // timestamp of the previous decoded frame
+    double frame_step = 1.0 / video_info.fps;  // source seconds between decoded frames
+    YuvView shown;  // frame on screen (decoded or cached)
+    bool refresh_pending = false;  // show one new frame even when paused (after a resize)
+    string outbuf;  // encoded frame, reused across frames
+    Renderer renderer(render_options(cfg));  // the render kernel for this session's settings
+    ScenePalette scene;  // -256a
+    string palette_update;  // OSC 4 for a new scene palette, goes out with the next frame
+    if (cfg.adaptive_palette) scene_palette_start(scene);
+    outbuf.reserve(frame_bytes * 4);
+    const double refresh_dt = 1.0 / cfg.fps;  // display tick period
+
+    PlaybackStats stats;
+    bool resize_pending = false;
+    chrono::steady_clock::time_point zoom_start;
+    bool zoom_pending = false;
+    auto resize_start = chrono::steady_clock::now();
+    bool restart_pending = false;  // decoder (re)started, first frame not shown yet
+    auto restart_time = chrono::steady_clock::now();
 
-    auto last = chrono::steady_clock::now();
     double current_time = 0.0;
     bool paused = false;
     float current_speed = cfg.speed;
-    int64_t frame_count = 0;
     double seek_step = get_seek_step(video_info.duration);
-    
-    while(!g_stop){
-        if (!paused) {
-            size_t got = fread(frame.data(), 1, frame_bytes, pipe);
-            if(got < frame_bytes) {
-                if (cfg.loop) {
-                    // Loop video
-                    pclose(pipe);
-                    pipe = popen(base_cmd_str.c_str(), "r");
-                    if (!pipe) break;
-                    frame_count = 0;
-                    current_time = 0.0;
-                    continue;
-                } else {
-                    break;
-                }
+    bool running = true;
+
+    // Media clock: runs at current_speed while playing, frozen while paused.
+    // A frame is shown when the clock reaches its timestamp; display ticks in
+    // between only refresh the status bar. With -A the audio being heard is
+    // the clock, and the wall clock only covers for it when there is none.
+    MediaClock clock;  // follows the audio while clock.audio is set
+    clock.speed = current_speed;
+    bool clock_anchored = false;  // set by the first frame after (re)starting the decoder
+    double loop_at = -1.0;  // media time the looped decoder's first frame waits for, -1 = none
+    int drop_run = 0;
+    auto set_clock = [&](double t) { clock.set(t); };
+    auto media_clock = [&]() { return paused ? clock.base() : clock.now(); };
+    // (Re)start audio at the clock's position after every jump, pause and speed change.
+    // Keyframe fast-forward plays without sound.
+    auto sync_audio = [&]() {
+        if (!audio.sink) return;
+        bool wanted = !paused && current_speed < KEYFRAME_SPEED && (!probe_done || video_info.audio_streams > 0);
+        if (!wanted) {
+            audio_stop(audio);
+            clock.audio = nullptr;
+            return;
+        }
+        clock.audio = audio_start(audio, cfg.infile, clock.base(), current_speed) ? &audio : nullptr;
+    };
+
+    LoopCache cache;
+    cache.budget = playlist.size() > 1 ? 0 : cfg.loop_cache_mb << 20;
+    // Capture needs a contiguous pass from the start; a seek breaks it
+    auto expected_frames = [&]() { return (size_t)(video_info.duration * video_info.fps * 1.05) + 1; };
+    auto cache_time = [&](size_t i) { return cache.times[i]; };
+    bool capturing = cache.budget > 0 && !keyframe_mode;
+    if (capturing) loop_cache_reset(cache, compact_frame_bytes(cfg), expected_frames());
+    bool replaying = false;
+    size_t replay_index = 0;
+
+    RewindRing ring;
+    ring_reset(ring, compact_frame_bytes(cfg), cfg.rewind_mb << 20);
+    long ring_cursor = -1;  // next ring frame to show while behind the decoder, -1 = live
+
+    auto restart_decoder = [&](double position) {
+        // Switch between normal and keyframe-only decoding as the speed requires
+        keyframe_mode = current_speed >= KEYFRAME_SPEED;
+        if (decoder->fd() >= 0) watch_fd(ep, decoder->fd(), false);
+        if (!decoder->start(decode_settings(cfg), position, keyframe_mode)) return false;
+        add_fd(ep, decoder->fd());
+        restart_time = chrono::steady_clock::now();
+        restart_pending = true;
+        next_ready = false;
+        decoded_pts = -1.0;
+        clock_anchored = false;
+        loop_at = -1.0;
+        capturing = false;
+        // Ring timestamps must stay contiguous with the decoder
+        ring.count = 0;
+        ring_cursor = -1;
+        return true;
+    };
+
+    // Hash of the frame on screen, valid until the screen is cleared
+    uint64_t screen_hash = 0;
+    bool screen_valid = false;
+    Stabilizer stabilizer(cfg.hold);  // -hold
+
+    auto redraw = [&]() {
+        if (shown.y) {
+            renderer.render(outbuf, shown, x_offset, y_offset);
+            if (!palette_update.empty()) {
+                outbuf.insert(0, palette_update);
+                server.preamble = move(palette_update);
+                palette_update.clear();
+            }
+            server_broadcast(server, ep, outbuf);
+            stats.bytes_out += outbuf.size();
+            screen.submit(outbuf);
+        }
+        draw_status_bar(screen, current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
+    };
+
+    // Put a frame on screen and move the clock to it
+    auto show_frame = [&](YuvView view, double time) {
+        bool forced = refresh_pending;
+        if (cfg.hold > 0) {
+            // A seek or a new layout starts from the real picture
+            if (forced) stabilizer.reset();
+            view = stabilizer.apply(view, cfg.out_w, cfg.out_h);
+        }
+        shown = view;
+        refresh_pending = false;
+        if (stats.frames_shown++ == 0) {
+            stats.startup_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - launch_time).count();
+        }
+
+        current_time = time;
+        if (paused) set_clock(time);  // frame steps move the paused clock
+        if (cfg.adaptive_palette && scene_palette_update(scene, view, cfg.out_w, cfg.out_h)) {
+            palette_update = palette_osc(*scene.current);
+            renderer = Renderer(render_options(cfg, scene.current));
+        }
+        // Same picture as on screen (a slide, a still camera): only the
+        // status bar moves
+        uint64_t hash = frame_hash(view, cfg.out_w, cfg.out_h);
+        bool update = !forced && screen_valid && palette_update.empty();
+        if (update && hash == screen_hash) {
+            stats.frames_repeated++;
+            draw_status_bar(screen, current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
+        } else if (update && cfg.hold > 0 && cfg.serve.empty()) {
+            // -hold: rows where nothing moved stay as they are on screen.
+            // Clients joining a -serve session need whole frames.
+            renderer.render_rows(outbuf, view, x_offset, y_offset, stabilizer.changed_rows());
+            stats.bytes_out += outbuf.size();
+            screen.submit(outbuf);
+            draw_status_bar(screen, current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
+            screen_hash = hash;
+        } else {
+            redraw();
+            screen_hash = hash;
+            screen_valid = true;
+        }
+
+        // How far the frame is from the audio heard while it went out
+        double heard;
+        if (clock.audio && !paused && !forced && audio_clock(audio, heard) == AUDIO_PLAYING) {
+            double err = fabs(time - heard) * 1000.0;
+            stats.av_frames++;
+            stats.av_error_sum_ms += err;
+            stats.av_error_max_ms = max(stats.av_error_max_ms, err);
+            if (err > 40.0) stats.av_frames_over++;
+        }
+
+        if (restart_pending) {
+            restart_pending = false;
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - restart_time).count();
+            stats.restarts++;
+            stats.restart_ms_sum += ms;
+            stats.max_restart_ms = max(stats.max_restart_ms, ms);
+        }
+
+        if (resize_pending) {
+            resize_pending = false;
+            stats.last_resize_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - resize_start).count();
+            stats.max_resize_ms = max(stats.max_resize_ms, stats.last_resize_ms);
+        }
+
+        if (zoom_pending) {
+            zoom_pending = false;
+            stats.last_zoom_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - zoom_start).count();
+            stats.max_zoom_ms = max(stats.max_zoom_ms, stats.last_zoom_ms);
+        }
+    };
+
+    auto show_cached = [&](size_t i) {
+        show_frame(compact_view(cache.frame(i), cfg), cache_time(i));
+    };
+
+    // A frame shown from the ring is copied out first: redraws still need
+    // it after later pushes have overwritten its slot
+    vector<unsigned char> ring_shown;
+    auto show_ring = [&](long i) {
+        ring_shown.assign(ring.frame(i), ring.frame(i) + ring.slot_bytes);
+        show_frame(compact_view(ring_shown.data(), cfg), ring.times[ring.slot(i)]);
+    };
+
+    // Show the next frame if the clock has reached it. A frame that is
+    // already overtaken by the one after it is skipped without encoding.
+    auto try_present = [&]() {
+        if (paused && !refresh_pending) return;
+        bool forced = refresh_pending;
+        double due = media_clock() + refresh_dt / 2;
+
+        if (replaying) {
+            if (replay_index >= cache.frames) {
+                // Loop point: the last cached frame stays up for its own
+                // duration, then playback wraps to the first one
+                if (!cfg.loop) { running = false; return; }
+                if (!forced && cache.frames > 0 && cache_time(cache.frames - 1) + frame_step > due) return;
+                replay_index = 0;
+                set_clock(cache_time(0));
+                sync_audio();
+                due = cache_time(0) + refresh_dt / 2;
+                stats.loop_replays++;
             }
-            
-            frame_count++;
-            if (video_info.fps > 0) {
-                current_time = frame_count / video_info.fps;
+            if (!forced && cache_time(replay_index) > due) return;
+            while (!forced && replay_index + 1 < cache.frames && cache_time(replay_index + 1) <= due) {
+                replay_index++;
+                stats.frames_dropped++;
             }
+            show_cached(replay_index++);
+            return;
         }
 
-        cout << "\x1b[H";
-        
-        // Add top padding for vertical centering
-        if(y_offset > 0) {
-            for(int i = 0; i < y_offset; i++) {
-                cout << "\n";
+        if (ring_cursor >= 0) {
+            // Behind the decoder after a rewind: play forward from the ring
+            if (!forced && ring.times[ring.slot(ring_cursor)] > due) return;
+            while (!forced && ring_cursor + 1 < (long)ring.count && ring.times[ring.slot(ring_cursor + 1)] <= due) {
+                ring_cursor++;
+                stats.frames_dropped++;
             }
+            show_ring(ring_cursor++);
+            if (ring_cursor >= (long)ring.count) ring_cursor = -1;
+            return;
         }
-        
-        if (!paused) {
-            for(int y = 0; y < cfg.out_h; y += 2){ // 2 lines per terminal row
-                // Add left padding for centering
-                if(x_offset > 0) {
-                    cout << string(x_offset, ' ');
-                }
-                
-                for(int x = 0; x < cfg.out_w; x++){
-                    size_t idx = (y * cfg.out_w + x) * 3;
-                    int r = frame[idx], g = frame[idx+1], b = frame[idx+2];
-                    int l = lum(r, g, b);
-                    char c = cfg.chars[clampi(l * (ramp_len - 1) / 255, 0, ramp_len - 1)];
-                    
-                    if(cfg.truecolor) cout << ansi_true(r, g, b) << c;
-                    else if(cfg.color256) cout << ansi256(r, g, b) << c;
-                    else cout << c;
-                }
-                cout << "\x1b[0m\n";
+
+        if (!next_ready) return;
+        if (!clock_anchored) {
+            if (loop_at >= 0) {
+                // Looping: the previous pass's last frame is still up
+                // until its duration ends, and its audio ends with it
+                if (!forced && loop_at > due) return;
+                loop_at = -1.0;
+                clock.audio = nullptr;
             }
+            // Start the clock at the first frame so decoder startup and seek
+            // latency don't make everything after it late. Audio that is
+            // already playing (or starting) keeps the clock instead.
+            if (!clock.audio) {
+                set_clock(next_pts);
+                sync_audio();
+            }
+            clock_anchored = true;
+            due = media_clock() + refresh_dt / 2;
+        }
+        if (!forced && next_pts > due) return;
+
+        // The loop cache needs every frame, shown or not
+        if (capturing) capturing = loop_cache_add(cache, next_frame.data(), cfg.out_w, cfg.out_h, next_pts);
+
+        // Late by a whole frame: drop it, but never starve the display
+        bool late = !forced && next_pts + frame_step <= due && drop_run < 8;
+        if (late) {
+            drop_run++;
+            stats.frames_dropped++;
+            next_ready = false;
+            watch_fd(ep, decoder->fd(), true);
+            return;
+        }
+        drop_run = 0;
+
+        swap(frame, next_frame);
+        next_ready = false;
+        watch_fd(ep, decoder->fd(), true);
+        show_frame(full_view(frame.data(), cfg), next_pts);
+        ring_push(ring, frame.data(), cfg.out_w, cfg.out_h, current_time);
+    };
+
+    // Playlist: while an item plays, the next one is probed on a thread and
+    // its decoder started, so switching at the end is a swap of decoders
+    size_t item = 0;
+    long next_item = -1;  // item being prepared, -1 = none
+    future<VideoInfo> next_probe;
+    bool next_probed = false;
+    VideoInfo next_info;
+    Config next_cfg;
+    int next_x_offset = 0, next_y_offset = 0;
+    unique_ptr<Decoder> next_decoder;
+
+    auto prepare_next = [&]() {
+        next_decoder.reset();
+        next_probed = false;
+        next_item = -1;
+        if (playlist.size() < 2) return;
+        size_t idx = item + 1;
+        if (idx >= playlist.size()) {
+            if (!cfg.loop) return;
+            idx = 0;
+        }
+        next_item = idx;
+        next_probe = async(launch::async, [file = playlist[idx]]() {
+            VideoInfo info;
+            probe_video(file, info);
+            return info;
+        });
+    };
+
+    // -crop and zoom state, per item
+    CropArea bars;  // inside the black bars -crop found (empty: the whole picture)
+    double zoom = 1.0, zoom_x = 0.5, zoom_y = 0.5;  // view centre as fractions of bars
+    CropCancel crop_stop;  // outlives crop_job, whose thread uses it
+    future<CropArea> crop_job;
+    string crop_file;  // the file crop_job is looking at
+    bool crop_widen = false;  // crop_job is a recheck: it can only add to bars
+    double crop_checked = -1.0;  // playback time of the last check, -1 = none yet for this item
+
+    // Start the next item's decoder once its probe is in; it fills its pipe
+    // and waits there until we switch
+    auto poll_next = [&](bool wait) {
+        if (next_item < 0 || next_decoder) return;
+        if (!next_probed) {
+            if (!wait && next_probe.wait_for(chrono::seconds(0)) != future_status::ready) return;
+            next_info = next_probe.get();
+            next_probed = true;
+        }
+        next_cfg = cfg;
+        next_cfg.infile = playlist[next_item];
+        next_cfg.crop = CropArea();  // until -crop has looked at it
+        apply_layout(next_cfg, next_info.width, next_info.height, cols, rows, next_x_offset, next_y_offset);
+        next_decoder = start_decoder(next_cfg, 0.0, false);
+    };
+
+    // Move on to the prepared item. Same output geometry keeps the buffers
+    // and the last frame on screen until the new one is due: no gap.
+    auto switch_item = [&]() {
+        if (next_item < 0) prepare_next();
+        if (next_item < 0) return false;
+        poll_next(true);
+        if (!next_decoder) return false;
+
+        if (decoder->fd() >= 0) watch_fd(ep, decoder->fd(), false);
+        // A probe of the first item still running would overwrite the new
+        // item's info when it finishes
+        if (prober.fd >= 0) {
+            watch_fd(ep, prober.fd, false);
+            stop_child(prober);
+            probe_out.clear();
+        }
+        probe_done = true;
+        decoder = move(next_decoder);
+        item = next_item;
+        video_info = next_info;
+        video_w = video_info.width;
+        video_h = video_info.height;
+        seek_step = get_seek_step(video_info.duration);
+        cfg.infile = next_cfg.infile;
+        cfg.crop = bars = CropArea();
+        crop_checked = -1.0;
+        zoom = 1.0;
+        x_offset = next_x_offset;
+        y_offset = next_y_offset;
+        if (next_cfg.out_w != cfg.out_w || next_cfg.out_h != cfg.out_h) {
+            cfg.out_w = next_cfg.out_w;
+            cfg.out_h = next_cfg.out_h;
+            frame_bytes = yuv_frame_bytes(cfg);
+            renderer = Renderer(render_options(cfg, scene.current));
+            frame.resize(frame_bytes);
+            next_frame.resize(frame_bytes);
+            shown = YuvView();
+            ring_reset(ring, compact_frame_bytes(cfg), cfg.rewind_mb << 20);
+            screen.clear();
+            screen_valid = false;
+        }
+        add_fd(ep, decoder->fd());
+        next_ready = false;
+        decoded_pts = -1.0;
+        clock_anchored = false;
+        loop_at = -1.0;
+        ring.count = 0;
+        ring_cursor = -1;
+        current_time = 0.0;
+        // The new item's audio starts when its first frame anchors the clock
+        audio_stop(audio);
+        clock.audio = nullptr;
+        // The pre-started decoder plays at normal speed
+        if (current_speed >= KEYFRAME_SPEED && !restart_decoder(0.0)) return false;
+        prepare_next();
+        return true;
+    };
+
+    // Recompute the geometry for the terminal and the source area, and
+    // restart decoding at the current timestamp if the frames change (new
+    // output size or crop), reusing the frame buffers
+    auto relayout = [&](bool crop_changed) {
+        // The prepared playlist item was laid out for the old size
+        next_decoder.reset();
+
+        int old_w = cfg.out_w, old_h = cfg.out_h, old_x = x_offset, old_y = y_offset;
+        apply_layout(cfg, video_w, video_h, cols, rows, x_offset, y_offset);
+        bool same_size = cfg.out_w == old_w && cfg.out_h == old_h;
+        // A new view at the same place overwrites the old one: no blank screen
+        if (!crop_changed || !same_size || x_offset != old_x || y_offset != old_y) {
+            screen.clear();
+            screen_valid = false;
+        }
+
+        if (!crop_changed && same_size) {
+            // Only the centering changed
+            redraw();
+            return;
+        }
+
+        if (!crop_changed) {
+            resize_start = chrono::steady_clock::now();
+            resize_pending = true;
+        }
+        frame_bytes = yuv_frame_bytes(cfg);
+        renderer = Renderer(render_options(cfg, scene.current));
+        frame.resize(frame_bytes);
+        next_frame.resize(frame_bytes);
+        shown = YuvView();
+
+        // Cached frames are the wrong size now; recapture on the next pass
+        replaying = false;
+        capturing = false;
+        if (cache.budget > 0) loop_cache_reset(cache, compact_frame_bytes(cfg), expected_frames());
+        ring_reset(ring, compact_frame_bytes(cfg), cfg.rewind_mb << 20);
+
+        if (!restart_decoder(current_time)) { running = false; return; }
+        refresh_pending = true;
+        draw_status_bar(screen, current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
+    };
+
+    // Terminal was resized
+    auto handle_resize = [&]() {
+        int new_cols, new_rows;
+        tie(new_cols, new_rows) = get_terminal_size();
+        if (new_cols == cols && new_rows == rows) return;
+        cols = new_cols;
+        rows = new_rows;
+        stats.resizes++;
+        relayout(false);
+    };
+
+    // -crop: start a check when one is due and switch to its area once it
+    // is in. Checks run in the background; playback never waits for them.
+    auto poll_crop = [&]() {
+        if (!cfg.auto_crop) return;
+        if (crop_job.valid()) {
+            if (crop_job.wait_for(chrono::seconds(0)) != future_status::ready) return;
+            CropArea area = crop_job.get();
+            int full_w = video_info.width, full_h = video_info.height;
+            if (crop_file != cfg.infile || full_w <= 0 || full_h <= 0) return;  // the item changed meanwhile
+            if (!crop_differs(area, CropArea(), full_w, full_h)) area = CropArea();
+            if (crop_widen) area = crop_union(area, bars);
+            if (!crop_differs(area, bars, full_w, full_h)) return;
+            bars = area;
+            cfg.crop = zoom_area(bars, full_w, full_h, zoom, zoom_x, zoom_y);
+            video_w = area.w > 0 ? area.w : full_w;
+            video_h = area.w > 0 ? area.h : full_h;
+            stats.crop_changes++;
+            relayout(true);
+            return;
+        }
+        if (!probe_done || video_info.width <= 0) return;
+        if (crop_checked >= 0 && fabs(current_time - crop_checked) < CROP_RECHECK) return;
+        vector<double> positions;
+        double duration = video_info.duration;
+        if (crop_checked < 0 && duration > 0) {
+            for (double f : {0.1, 0.3, 0.5, 0.7, 0.9}) positions.push_back(duration * f);
         } else {
-            // Just redraw last frame when paused
-            for(int y = 0; y < cfg.out_h; y += 2){
-                if(x_offset > 0) {
-                    cout << string(x_offset, ' ');
+            for (double ahead : {2.0, 6.0, 10.0}) {
+                double t = current_time + ahead;
+                if (duration <= 0 || t < duration) positions.push_back(t);
+            }
+            if (positions.empty()) positions.push_back(current_time);
+        }
+        crop_widen = crop_checked >= 0;
+        crop_checked = current_time;
+        crop_file = cfg.infile;
+        crop_job = async(launch::async, detect_crop, cfg.infile, positions, &crop_stop);
+    };
+
+    // Decode a new view at the current position. Needs the source size, so
+    // not before the probe is in.
+    auto set_view = [&](double new_zoom, double new_x, double new_y) {
+        int full_w = video_info.width, full_h = video_info.height;
+        if (full_w <= 0 || full_h <= 0) return;
+        new_zoom = clamp(new_zoom, 1.0, ZOOM_MAX);
+        CropArea view = zoom_area(bars, full_w, full_h, new_zoom, new_x, new_y);
+        zoom = new_zoom;
+        zoom_x = new_x;
+        zoom_y = new_y;
+        if (view.x == cfg.crop.x && view.y == cfg.crop.y && view.w == cfg.crop.w && view.h == cfg.crop.h) return;
+        cfg.crop = view;
+        stats.zooms++;
+        zoom_start = chrono::steady_clock::now();
+        zoom_pending = true;
+        relayout(true);
+    };
+
+    auto handle_key = [&](const unsigned char* keys, ssize_t n) {
+        for (ssize_t i = 0; i < n; i++) {
+            unsigned char c = keys[i];
+            if(c == 0x1b && i + 5 < n && keys[i+1] == '[' && keys[i+2] == '1' && keys[i+3] == ';' && keys[i+4] == '2') {  // Shift+arrow - pan
+                unsigned char code = keys[i+5];
+                i += 5;
+                double step = PAN_STEP / zoom;
+                if (code == 'A') set_view(zoom, zoom_x, zoom_y - step);
+                else if (code == 'B') set_view(zoom, zoom_x, zoom_y + step);
+                else if (code == 'C') set_view(zoom, zoom_x + step, zoom_y);
+                else if (code == 'D') set_view(zoom, zoom_x - step, zoom_y);
+                if (!running) return;
+            }
+            else if(c == 0x1b && i + 2 < n && keys[i+1] == '[') {  // Escape sequence for arrow keys
+                unsigned char code = keys[i+2];
+                i += 2;
+                double seek_amount = seek_step;
+                double new_time = current_time;
+                
+                if(code == 'D') {  // Left arrow
+                    new_time = max(0.0, current_time - seek_amount);
+                    if(cfg.play_sound) play_sound_effect("seek", &screen);
+                }
+                else if(code == 'C') {  // Right arrow
+                    new_time = min(video_info.duration, current_time + seek_amount);
+                    if(cfg.play_sound) play_sound_effect("seek", &screen);
                 }
                 
-                for(int x = 0; x < cfg.out_w; x++){
-                    size_t idx = (y * cfg.out_w + x) * 3;
-                    int r = frame[idx], g = frame[idx+1], b = frame[idx+2];
-                    int l = lum(r, g, b);
-                    char c = cfg.chars[clampi(l * (ramp_len - 1) / 255, 0, ramp_len - 1)];
+                if (new_time != current_time) {
+                    // Seek to new position
+                    paused = false;  // Unpause when seeking
+                    
+                    current_time = new_time;
+                    set_clock(new_time);
                     
-                    if(cfg.truecolor) cout << ansi_true(r, g, b) << c;
-                    else if(cfg.color256) cout << ansi256(r, g, b) << c;
-                    else cout << c;
+                    long ring_index = replaying ? -1 : ring_find(ring, new_time);
+                    if (replaying) {
+                        // Seek inside the cached clip
+                        replay_index = upper_bound(cache.times.begin(), cache.times.end(), new_time) - cache.times.begin();
+                        if (replay_index > 0) replay_index--;
+                        set_clock(cache_time(replay_index));
+                    } else if (ring_index >= 0) {
+                        // Recently shown: play on from the rewind ring
+                        ring_cursor = ring_index;
+                        set_clock(ring.times[ring.slot(ring_index)]);
+                        stats.rewind_seeks++;
+                    } else {
+                        if (!restart_decoder(new_time)) { running = false; return; }
+                    }
+                    // Audio starts seeking alongside the video decoder
+                    sync_audio();
+                    set_tick(tick_fd, refresh_dt);
+                    try_present();
                 }
-                cout << "\x1b[0m\n";
             }
-        }
-        
-        // Fill remaining lines if needed (for full terminal mode or when video is smaller)
-        if(cfg.force_full_terminal || y_offset > 0) {
-            int lines_remaining = rows - (cfg.out_h / 2) - y_offset;
-            for(int i = 0; i < lines_remaining; i++) {
-                cout << "\n";
+            else if(c == 'q' || c == 27) { running = false; return; }  // q or ESC
+            else if(c == ' ') {  // Space - pause
+                if (!paused) {
+                    set_clock(media_clock());
+                    paused = true;
+                    set_tick(tick_fd, 0);
+                } else {
+                    paused = false;
+                    set_clock(clock.base());
+                    set_tick(tick_fd, refresh_dt);
+                }
+                sync_audio();
+                draw_status_bar(screen, current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
+                if(cfg.play_sound) play_beep(screen);
             }
-        }
-        
-        // Draw status bar
-        draw_status_bar(current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
-        
-        cout.flush();
-
-        // key check
-        int c;
-        fd_set fds; 
-        struct timeval tv = {0, 0};
-        FD_ZERO(&fds); 
-        FD_SET(STDIN_FILENO, &fds);
-        
-        if(select(STDIN_FILENO + 1, &fds, nullptr, nullptr, &tv) > 0) {
-            if(read(STDIN_FILENO, &c, 1) > 0) {
-                if(c == 'q' || c == 27) break;  // q or ESC
-                else if(c == ' ') {  // Space - pause
-                    paused = !paused;
-                    if(cfg.play_sound) play_beep();
+            else if(c == 'L' || c == 'l') {  // L - toggle loop
+                cfg.loop = !cfg.loop;
+                draw_status_bar(screen, current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
+                if(cfg.play_sound) play_beep(screen);
+            }
+            else if(c == 'w' || c == 'W' || c == 's' || c == 'S') {  // w/s - change speed
+                if (!paused) set_clock(media_clock());
+                if (c == 'w' || c == 'W') current_speed = min(100.0f, current_speed * 1.1f);
+                else current_speed = max(0.01f, current_speed * 0.9f);
+                clock.speed = current_speed;
+                // Frames carry their own timestamps, so only crossing the
+                // keyframe threshold needs a different decoder
+                bool want_ff = current_speed >= KEYFRAME_SPEED;
+                if (!replaying && want_ff != keyframe_mode) {
+                    if (!restart_decoder(media_clock())) { running = false; return; }
+                    refresh_pending = paused;
                 }
-                else if(c == 'L' || c == 'l') {  // L - toggle loop
-                    cfg.loop = !cfg.loop;
-                    if(cfg.play_sound) play_beep();
+                // Audio is retimed with atempo from where it is now
+                if (!paused) sync_audio();
+                draw_status_bar(screen, current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
+                if(cfg.play_sound) play_beep(screen);
+            }
+            else if(c == ',' || c == '.') {  // ,/. - previous/next frame
+                if (!paused) {
+                    set_clock(media_clock());
+                    paused = true;
+                    set_tick(tick_fd, 0);
+                    sync_audio();
                 }
-                else if(c == 'w' || c == 'W') {  // w - increase speed
-                    current_speed = min(100.0f, current_speed * 1.1f);
-                    if(cfg.play_sound) play_beep();
+                if (replaying) {
+                    if (c == ',' && replay_index >= 2) {
+                        replay_index -= 2;
+                        show_cached(replay_index++);
+                    } else if (c == '.' && replay_index < cache.frames) {
+                        show_cached(replay_index++);
+                    }
+                } else if (c == ',') {
+                    // Index of the frame on screen: the newest ring frame unless rewound
+                    long cur = ring_cursor >= 0 ? ring_cursor - 1 : (long)ring.count - 1;
+                    if (cur > 0) {
+                        show_ring(cur - 1);
+                        ring_cursor = cur;
+                    }
+                } else if (ring_cursor >= 0) {
+                    show_ring(ring_cursor++);
+                    if (ring_cursor >= (long)ring.count) ring_cursor = -1;
+                } else {
+                    // Show the next decoded frame as soon as it's complete
+                    refresh_pending = true;
                 }
-                else if(c == 's' || c == 'S') {  // s - decrease speed
-                    current_speed = max(0.01f, current_speed * 0.9f);
-                    if(cfg.play_sound) play_beep();
+                draw_status_bar(screen, current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
+            }
+            else if(c == 'n' && playlist.size() > 1) {  // n - next playlist item
+                if (!switch_item()) { running = false; return; }
+            }
+            else if(c == 'b' && cfg.play_sound) {  // b - manual beep
+                play_beep(screen);
+            }
+            else if(c == '+' || c == '=' || c == '-') {  // +/- - zoom in/out around the view centre
+                set_view(c == '-' ? zoom / ZOOM_STEP : zoom * ZOOM_STEP, zoom_x, zoom_y);
+                if (!running) return;
+            }
+            else if(c == '0') {  // 0 - whole picture
+                set_view(1.0, 0.5, 0.5);
+                if (!running) return;
+            }
+        }
+    };
+
+    set_tick(tick_fd, refresh_dt);
+    prepare_next();
+
+    struct epoll_event events[8];
+    while(running && !g_stop){
+        int n = epoll_wait(ep, events, 8, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int e = 0; e < n && running; e++) {
+            int fd = events[e].data.fd;
+
+            if (fd == sig_fd) {
+                struct signalfd_siginfo si;
+                while (read(sig_fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+                    if (si.ssi_signo == SIGWINCH) {
+                        handle_resize();
+                    } else {
+                        running = false;
+                    }
+                }
+            }
+            else if (fd == STDIN_FILENO) {
+                unsigned char keys[64];
+                ssize_t got = read(STDIN_FILENO, keys, sizeof(keys));
+                if (got > 0) handle_key(keys, got);
+                try_present();
+            }
+            else if (fd == tick_fd) {
+                uint64_t expirations;
+                if (read(tick_fd, &expirations, sizeof(expirations)) > 0) {
+                    poll_next(false);
+                    poll_crop();
+                    int64_t before = stats.frames_shown;
+                    try_present();
+                    // No new frame: only the status bar, and only when its time changes
+                    if (stats.frames_shown == before && !paused && clock_anchored) {
+                        double now = media_clock();
+                        if ((int)now != (int)current_time) {
+                            current_time = now;
+                            draw_status_bar(screen, current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
+                            stats.status_refreshes++;
+                        }
+                    }
                 }
-                else if(c == 'b' && cfg.play_sound) {  // b - manual beep
-                    play_beep();
+            }
+            else if (fd == prober.fd) {
+                char buf[4096];
+                ssize_t got = read(prober.fd, buf, sizeof(buf));
+                if (got > 0) {
+                    probe_out.append(buf, got);
+                } else if (got == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    finish_probe();
+                    seek_step = get_seek_step(video_info.duration);
+                    if (layout_needs_probe && video_info.width > 0 && video_info.height > 0) {
+                        video_w = video_info.width;
+                        video_h = video_info.height;
+                        relayout(false);
+                    }
+                    draw_status_bar(screen, current_time, video_info.duration, paused, cfg.loop, current_speed, cols);
                 }
-                else if(c == 0x1b) {  // Escape sequence for arrow keys
-                    char seq[2];
-                    if(read(STDIN_FILENO, &seq[0], 1) > 0 && read(STDIN_FILENO, &seq[1], 1) > 0) {
-                        if(seq[0] == '[') {
-                            double seek_amount = seek_step;
-                            double new_time = current_time;
-                            
-                            if(seq[1] == 'D') {  // Left arrow
-                                new_time = max(0.0, current_time - seek_amount);
-                                if(cfg.play_sound) play_sound_effect("seek");
-                            }
-                            else if(seq[1] == 'C') {  // Right arrow
-                                new_time = min(video_info.duration, current_time + seek_amount);
-                                if(cfg.play_sound) play_sound_effect("seek");
-                            }
-                            
-                            if (new_time != current_time) {
-                                // Seek to new position
-                                paused = false;  // Unpause when seeking
-                                
-                                // Calculate frame number at new time
-                                int64_t new_frame = (int64_t)(new_time * video_info.fps);
-                                frame_count = new_frame;
-                                current_time = new_time;
-                                
-                                // Seek video
-                                if (seek_video(pipe, base_cmd_str, new_time, cfg.out_w, cfg.out_h, cfg.fps)) {
-                                    // Read one frame to sync
-                                    fread(frame.data(), 1, frame_bytes, pipe);
-                                }
-                            }
+            }
+            else if (server_owns(server, fd)) {
+                server_event(server, ep, fd, events[e].events);
+            }
+            else if (fd == decoder->fd()) {
+                double pts = 0.0;
+                int got = decoder->read_frame(next_frame.data(), frame_bytes, pts);
+                if (got > 0) {
+                    next_ready = true;
+                    next_pts = pts;
+                    if (decoded_pts >= 0 && pts > decoded_pts) frame_step = pts - decoded_pts;
+                    decoded_pts = pts;
+                    // Stop watching until this frame is shown (backpressure on ffmpeg)
+                    watch_fd(ep, decoder->fd(), false);
+                    try_present();
+                } else if (got < 0) {
+                    if (playlist.size() > 1 && (item + 1 < playlist.size() || cfg.loop)) {
+                        if (!switch_item()) { running = false; break; }
+                    } else if (cfg.loop && capturing && cache.frames > 0) {
+                        // The whole clip is in memory: replay it from there
+                        // from now on, with no decoder and no gap
+                        capturing = false;
+                        replaying = true;
+                        replay_index = cache.frames;
+                        decoder->stop();
+                        try_present();
+                    } else if (cfg.loop) {
+                        // Loop video; the first frame of the next pass
+                        // waits until the last one has had its duration
+                        double wrap = (decoded_pts >= 0 ? decoded_pts : current_time) + frame_step;
+                        if (!restart_decoder(0.0)) { running = false; break; }
+                        loop_at = wrap;
+                        if (cache.budget > 0 && !cache.overflow && !keyframe_mode) {
+                            loop_cache_reset(cache, compact_frame_bytes(cfg), expected_frames());
+                            capturing = !cache.overflow;
                         }
+                    } else {
+                        running = false;
                     }
                 }
             }
         }
-
-        if (!paused) {
-            auto now = chrono::steady_clock::now();
-            double elapsed = chrono::duration<double>(now - last).count();
-            double adjusted_frame_dt = base_frame_dt / current_speed;
-            
-            if(elapsed < adjusted_frame_dt) 
-                this_thread::sleep_for(chrono::duration<double>(adjusted_frame_dt - elapsed));
-            last = chrono::steady_clock::now();
-        } else {
-            // When paused, just sleep a bit to reduce CPU usage
-            this_thread::sleep_for(chrono::milliseconds(10));
-        }
     }
 
-    pclose(pipe);
-    restore_term();
+    audio_stop(audio);
+    decoder->stop();
+    stop_child(prober);
+    if (cfg.adaptive_palette) server_finish(server, ep, PALETTE_RESET);
+    server_close(server);
+    close(ep);
+    close(tick_fd);
+    close(sig_fd);
+    crop_cancel(crop_stop);  // a check still running would hold up the exit
+    if (cfg.adaptive_palette) {
+        scene_palette_stop(scene);
+        screen.present(PALETTE_RESET);
+    }
+    screen.leave();
     
     if(cfg.play_sound) play_sound_effect("end");
+
+    if(cfg.show_stats) {
+        cerr << "\nFrames shown: " << stats.frames_shown << ", dropped: " << stats.frames_dropped
+             << ", status-only refreshes: " << stats.status_refreshes;
+        if (stats.frames_shown > 0) {
+            cerr << "\nRepeats not redrawn: " << stats.frames_repeated << " (" << fixed << setprecision(1)
+                 << 100.0 * stats.frames_repeated / stats.frames_shown << "% of frames shown)";
+        }
+        print_output_stats(stats, stabilizer);
+        cerr << fixed << setprecision(1) << "\nStartup: " << stats.startup_ms << " ms to first frame ("
+             << decoder->name() << " decoder)";
+        if (stats.restarts > 0) {
+            cerr << "\nDecoder seeks: " << stats.restarts << " (to first frame: mean "
+                 << stats.restart_ms_sum / stats.restarts << " ms, max " << stats.max_restart_ms << " ms)";
+        }
+        // Children are reaped by now, so their CPU time is included
+        struct rusage self_usage, child_usage;
+        getrusage(RUSAGE_SELF, &self_usage);
+        getrusage(RUSAGE_CHILDREN, &child_usage);
+        auto cpu_ms = [](const struct rusage& u) {
+            return (u.ru_utime.tv_sec + u.ru_stime.tv_sec) * 1000.0 + (u.ru_utime.tv_usec + u.ru_stime.tv_usec) / 1000.0;
+        };
+        if (stats.frames_shown > 0) {
+            cerr << "\nCPU: " << (cpu_ms(self_usage) + cpu_ms(child_usage)) / stats.frames_shown
+                 << " ms per frame shown (player and decoders)";
+        }
+        if (stats.resizes > 0) {
+            cerr << "\nResizes: " << stats.resizes << fixed << setprecision(1)
+                 << " (resize to first frame: last " << stats.last_resize_ms
+                 << " ms, max " << stats.max_resize_ms << " ms)";
+        }
+        if (stats.zooms > 0) {
+            cerr << "\nZoom/pan: " << stats.zooms << fixed << setprecision(1)
+                 << " (key to first frame: last " << stats.last_zoom_ms
+                 << " ms, max " << stats.max_zoom_ms << " ms)";
+        }
+        if (cfg.adaptive_palette) cerr << "\nScene palettes: " << scene.changes;
+        if (cfg.auto_crop) {
+            cerr << "\nCrop: ";
+            if (bars.w > 0) cerr << bars.w << "x" << bars.h << " at " << bars.x << "," << bars.y;
+            else cerr << "none";
+            cerr << " (" << stats.crop_changes << " changes)";
+        }
+        if (ring.capacity > 0) {
+            cerr << "\nRewind: " << ring.capacity << " frames, " << stats.rewind_seeks << " seeks served from memory";
+        }
+        if (cache.budget > 0) {
+            if (cache.overflow) cerr << "\nLoop cache: clip exceeds " << cfg.loop_cache_mb << " MB, re-decoding";
+            else cerr << "\nLoop cache: " << cache.frames << " frames (" << setprecision(1) << cache.frames * cache.frame_bytes / 1048576.0
+                      << " MB), " << stats.loop_replays << " loops replayed";
+        }
+        if (stats.av_frames > 0) {
+            cerr << "\nA/V sync: mean " << setprecision(1) << stats.av_error_sum_ms / stats.av_frames
+                 << " ms, max " << stats.av_error_max_ms << " ms, " << stats.av_frames_over << " of "
+                 << stats.av_frames << " frames over 40 ms";
+        }
+        server_print_stats(server);
+        cerr << "\n";
+    }
     
     cout << "\n";
     return 0;